@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "admin.h"
+#include "event.h"
+#include "metrics.h"
+#include "log.h"
+#include "socket.h"
+#include "worker.h"
+
+#define ADMIN_QUEUE 16
+#define METRICS_SIZE 16384
+
+static sigset_t admin_signals;
+static uint64_t started;
+
+void admin_block_signals(void) {
+    sigemptyset(&admin_signals);
+    sigaddset(&admin_signals, SIGUSR1);
+    sigaddset(&admin_signals, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &admin_signals, NULL) != 0) {
+        perror("pthread_sigmask");
+        exit(1);
+    }
+    started = metrics_now();
+}
+
+/* Render every worker's metrics into buf. */
+static size_t render_metrics(char *buf, size_t size) {
+    struct metrics *shards[MAX_WORKERS];
+    for (int i = 0; i < num_workers; i++) {
+        shards[i] = &workers[i].metrics;
+    }
+    double uptime = (metrics_now() - started) / 1e6;
+    return metrics_format(buf, size, shards, num_workers, uptime);
+}
+
+/* Answer one scrape: read the request (whatever it is) and send the metrics
+ * as a plain text HTTP response, so both curl and scrapers can use it.
+ */
+static void serve_scrape(int listenfd) {
+    int fd = accept(listenfd, NULL, NULL);
+    if (fd == -1) {
+        log_error("admin_accept", LF_ERRNO(errno));
+        return;
+    }
+    // The admin thread serves one scrape at a time; don't let one hang it.
+    struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    char req[1024];
+    if (read(fd, req, sizeof(req)) < 0) {
+        close(fd);
+        return;
+    }
+
+    static char body[METRICS_SIZE];
+    size_t len = render_metrics(body, sizeof(body));
+    char head[128];
+    int hlen = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %zu\r\n\r\n", len);
+    if (write(fd, head, hlen) == hlen) {
+        if (write(fd, body, len) != (ssize_t)len) {
+            log_error("admin_write", LF_ERRNO(errno));
+        }
+    }
+    close(fd);
+}
+
+static void dump_metrics(void) {
+    static char body[METRICS_SIZE];
+    size_t len = render_metrics(body, sizeof(body));
+    fwrite(body, 1, len, stderr);
+    fflush(stderr);
+}
+
+/* Load dict_file again and make it the dictionary new games pick from.
+ * Games already running keep their word; the old dictionary is freed once
+ * no worker is using it. If the file can't be loaded the old one stays.
+ */
+static void reload_dictionary(char *dict_file) {
+    struct dictionary *dict = malloc(sizeof(struct dictionary));
+    if (dict == NULL) {
+        log_error("dictionary_reload_failed", LF_STR("file", dict_file),
+                  LF_ERRNO(errno));
+        return;
+    }
+    if (load_dictionary(dict, dict_file) == -1) {
+        log_error("dictionary_reload_failed", LF_STR("file", dict_file));
+        free(dict);
+        return;
+    }
+    struct dictionary *old = publish_dictionary(dict);
+    log_info("dictionary_reloaded", LF_STR("file", dict_file),
+             LF_INT("words", dict->size), LF_INT("was", old->size));
+    free_dictionary(old);
+    free(old);
+}
+
+void admin_run(int port, char *dict_file) {
+    struct event_loop *loop = event_loop_create(NULL);
+    if (loop == NULL) {
+        perror("event_loop_create");
+        exit(1);
+    }
+
+    int sigfd = signalfd(-1, &admin_signals, SFD_CLOEXEC);
+    if (sigfd == -1 || event_add(loop, sigfd, EV_READ) == -1) {
+        perror("signalfd");
+        exit(1);
+    }
+
+    int listenfd = -1;
+    if (port != 0) {
+        // Metrics are only offered to the local machine.
+        struct sockaddr_in *addr = init_server_addr(port);
+        addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listenfd = set_up_server_socket(addr, ADMIN_QUEUE, 0);
+        free(addr);
+        if (event_add(loop, listenfd, EV_READ) == -1) {
+            perror("event_add");
+            exit(1);
+        }
+        log_info("admin_listening", LF_STR("addr", "127.0.0.1"), LF_INT("port", port));
+    }
+
+    struct event ready[4];
+    while (1) {
+        int nready = event_wait(loop, ready, 4, -1);
+        if (nready == -1) {
+            if (errno != EINTR) {
+                log_error("admin_event_wait", LF_ERRNO(errno));
+            }
+            continue;
+        }
+        for (int i = 0; i < nready; i++) {
+            if (ready[i].fd == listenfd) {
+                serve_scrape(listenfd);
+            } else if (ready[i].fd == sigfd) {
+                struct signalfd_siginfo si;
+                if (read(sigfd, &si, sizeof(si)) != sizeof(si)) {
+                    continue;
+                }
+                if (si.ssi_signo == SIGUSR1) {
+                    dump_metrics();
+                } else if (si.ssi_signo == SIGHUP) {
+                    reload_dictionary(dict_file);
+                }
+            }
+        }
+    }
+}
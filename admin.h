@@ -0,0 +1,17 @@
+#ifndef _ADMIN_H_
+#define _ADMIN_H_
+
+/* The admin side of the server runs on the main thread, away from the
+ * workers: a localhost-only listener that reports metrics, and the signals
+ * that control the server: SIGUSR1 dumps the metrics to stderr and SIGHUP
+ * reloads the dictionary from dict_file.
+ */
+
+/* Block the signals the admin thread handles. Call before starting the
+ * workers so that they inherit the mask and never see them.
+ */
+void admin_block_signals(void);
+/* Serve the admin port (0 for none) and handle signals. Never returns. */
+void admin_run(int port, char *dict_file);
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "client.h"
+#include "log.h"
+
+/* table[fd] is the client using fd, or NULL. Every worker thread shares the
+ * table, but a slot is only written by the worker that owns the descriptor;
+ * a slot is cleared before its descriptor is closed so that another worker
+ * reusing the number never sees it overwritten.
+ */
+static struct client **table;
+static int table_size;
+
+#define CHUNK_CLIENTS 256     // slots carved out of malloc at a time
+#define FREE_BATCH 256        // free slots moved to or from the shared list
+
+/* chunks[i] holds slots i * CHUNK_CLIENTS and up. The directory is sized
+ * up front so it never moves; chunks are only ever added to it. There can
+ * be no more live clients than descriptors, and each thread holds at most
+ * two batches of free slots back, so this many chunks always suffice.
+ */
+static struct client **chunks;
+static int num_chunks;
+static int max_chunks;
+
+/* Free slots handed back by threads that had more than they need. */
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct client *shared_free;
+
+static __thread struct client *local_free;
+static __thread int local_count;
+
+/* Allocate the table with one slot for every descriptor we may be given,
+ * and the slab directory. Returns 0 on success and -1 on failure.
+ */
+int client_table_init(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY
+            || rl.rlim_cur > (1 << 20)) {
+        rl.rlim_cur = 1 << 20;
+    }
+    table_size = (int)rl.rlim_cur;
+    table = calloc(table_size, sizeof(struct client *));
+    max_chunks = table_size / CHUNK_CLIENTS + 3 * 64;
+    chunks = calloc(max_chunks, sizeof(struct client *));
+    if (table == NULL || chunks == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    return 0;
+}
+
+/* Return the client using fd, or NULL if no client uses it. */
+struct client *client_lookup(int fd) {
+    if (fd < 0 || fd >= table_size) {
+        return NULL;
+    }
+    return __atomic_load_n(&table[fd], __ATOMIC_ACQUIRE);
+}
+
+/* Record that p uses fd. Returns -1 if fd is outside the table. */
+int client_table_set(int fd, struct client *p) {
+    if (fd < 0 || fd >= table_size) {
+        log_error("client_table_full", LF_INT("fd", fd));
+        return -1;
+    }
+    __atomic_store_n(&table[fd], p, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void client_table_clear(int fd) {
+    if (fd >= 0 && fd < table_size) {
+        __atomic_store_n(&table[fd], NULL, __ATOMIC_RELEASE);
+    }
+}
+
+/* Move up to n free slots from *from onto this thread's list. */
+static void take_free(struct client **from, int n) {
+    while (*from != NULL && n-- > 0) {
+        struct client *p = *from;
+        *from = p->next;
+        p->next = local_free;
+        local_free = p;
+        local_count++;
+    }
+}
+
+/* Carve a new chunk of slots onto this thread's list. */
+static int grow_slab(void) {
+    pthread_mutex_lock(&slab_lock);
+    if (num_chunks == max_chunks) {
+        pthread_mutex_unlock(&slab_lock);
+        log_error("client_slab_full", LF_INT("chunks", num_chunks));
+        return -1;
+    }
+    struct client *chunk;
+    int err = posix_memalign((void **)&chunk, 64, CHUNK_CLIENTS * sizeof(struct client));
+    if (err != 0) {
+        pthread_mutex_unlock(&slab_lock);
+        log_error("posix_memalign", LF_ERRNO(err));
+        return -1;
+    }
+    int first = num_chunks * CHUNK_CLIENTS;
+    for (int i = CHUNK_CLIENTS - 1; i >= 0; i--) {
+        chunk[i].slot = first + i;
+        chunk[i].gen = 1;
+        chunk[i].next = local_free;
+        local_free = &chunk[i];
+    }
+    local_count += CHUNK_CLIENTS;
+    __atomic_store_n(&chunks[num_chunks], chunk, __ATOMIC_RELEASE);
+    num_chunks++;
+    pthread_mutex_unlock(&slab_lock);
+    return 0;
+}
+
+struct client *client_alloc(void) {
+    if (local_free == NULL) {
+        pthread_mutex_lock(&slab_lock);
+        take_free(&shared_free, FREE_BATCH);
+        pthread_mutex_unlock(&slab_lock);
+    }
+    if (local_free == NULL && grow_slab() == -1) {
+        return NULL;
+    }
+    struct client *p = local_free;
+    local_free = p->next;
+    local_count--;
+    return p;
+}
+
+void client_free(struct client *p) {
+    client_retag(p);
+    p->next = local_free;
+    local_free = p;
+    local_count++;
+
+    // A thread that frees what others allocated gives the surplus back.
+    if (local_count > 2 * FREE_BATCH) {
+        struct client *batch = NULL;
+        for (int i = 0; i < FREE_BATCH; i++) {
+            struct client *q = local_free;
+            local_free = q->next;
+            q->next = batch;
+            batch = q;
+        }
+        local_count -= FREE_BATCH;
+        pthread_mutex_lock(&slab_lock);
+        struct client *tail = batch;
+        while (tail->next != NULL) {
+            tail = tail->next;
+        }
+        tail->next = shared_free;
+        shared_free = batch;
+        pthread_mutex_unlock(&slab_lock);
+    }
+}
+
+client_handle client_handle_of(struct client *p) {
+    return (client_handle)p->slot << 32 | p->gen;
+}
+
+struct client *client_get(client_handle h) {
+    unsigned int slot = h >> 32;
+    unsigned int chunk = slot / CHUNK_CLIENTS;
+    if (h == 0 || chunk >= (unsigned int)max_chunks) {
+        return NULL;
+    }
+    struct client *base = __atomic_load_n(&chunks[chunk], __ATOMIC_ACQUIRE);
+    if (base == NULL) {
+        return NULL;
+    }
+    struct client *p = &base[slot % CHUNK_CLIENTS];
+    // The slot may belong to another worker by now.
+    if (__atomic_load_n(&p->gen, __ATOMIC_ACQUIRE) != (unsigned int)h) {
+        return NULL;
+    }
+    return p;
+}
+
+void client_retag(struct client *p) {
+    unsigned int gen = p->gen + 1;
+    // Generation 0 is never used, so no handle but 0 names no client.
+    if (gen == 0) {
+        gen = 1;
+    }
+    __atomic_store_n(&p->gen, gen, __ATOMIC_RELEASE);
+}
+
+void push_client(struct client **top, struct client *p) {
+    p->prev = NULL;
+    p->next = *top;
+    if (*top != NULL) {
+        (*top)->prev = p;
+    }
+    *top = p;
+}
+
+void unlink_client(struct client **top, struct client *p) {
+    if (p->prev == NULL && *top != p) {
+        log_error("unlink_unlisted_client", LF_INT("fd", p->fd));
+        return;
+    }
+    if (p->prev != NULL) {
+        p->prev->next = p->next;
+    } else {
+        *top = p->next;
+    }
+    if (p->next != NULL) {
+        p->next->prev = p->prev;
+    }
+    p->next = NULL;
+    p->prev = NULL;
+}
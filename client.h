@@ -0,0 +1,44 @@
+#ifndef _CLIENT_H_
+#define _CLIENT_H_
+
+#include <stdint.h>
+
+#include "gameplay.h"
+
+/* Every connected client indexed by its socket descriptor, so the client
+ * behind a ready descriptor is found with one array lookup instead of a walk
+ * over the player lists. The table is sized once from RLIMIT_NOFILE so it
+ * never moves, which lets every worker thread share it without a lock.
+ */
+int client_table_init(void);
+struct client *client_lookup(int fd);
+int client_table_set(int fd, struct client *p);
+void client_table_clear(int fd);
+
+/* Clients live in a slab of cache-aligned slots that is carved into chunks
+ * as it grows and never returned to malloc; each thread keeps its own list
+ * of free slots, so connecting and disconnecting take no lock.
+ *
+ * A handle names a slot and the generation of the client in it. Freeing a
+ * client, or handing it to another worker, moves its slot to a new
+ * generation, so a handle taken earlier resolves to NULL instead of to
+ * whoever uses the slot next. Handles are 0 for no client.
+ */
+typedef uint64_t client_handle;
+
+/* Return an uninitialised client, or NULL if the slab is full. */
+struct client *client_alloc(void);
+void client_free(struct client *p);
+client_handle client_handle_of(struct client *p);
+/* Return the client h refers to, or NULL if it is gone. */
+struct client *client_get(client_handle h);
+/* Make every existing handle to p stale. */
+void client_retag(struct client *p);
+
+/* Push p on the front of the list at top, or unlink it from that list.
+ * The lists are doubly linked so unlinking does not need a search.
+ */
+void push_client(struct client **top, struct client *p);
+void unlink_client(struct client **top, struct client *p);
+
+#endif
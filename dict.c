@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "dict.h"
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+/* Return the letters of word, bit i for 'a' + i. */
+static uint32_t letter_mask(const char *word, int len) {
+    uint32_t mask = 0;
+    for (int i = 0; i < len; i++) {
+        if (word[i] >= 'a' && word[i] <= 'z') {
+            mask |= 1U << (word[i] - 'a');
+        }
+    }
+    return mask;
+}
+
+/* Fill by_length and buckets from lengths with a counting sort, which
+ * keeps words of the same length in dictionary order.
+ */
+static void sort_by_length(const uint8_t *lengths, int size,
+                           uint32_t *buckets, uint32_t *by_length) {
+    uint32_t next[MAX_WORD];
+    memset(buckets, 0, (MAX_WORD + 1) * sizeof(uint32_t));
+    for (int i = 0; i < size; i++) {
+        buckets[lengths[i] + 1]++;
+    }
+    for (int n = 1; n <= MAX_WORD; n++) {
+        buckets[n] += buckets[n - 1];
+    }
+    memcpy(next, buckets, sizeof(next));
+    for (int i = 0; i < size; i++) {
+        by_length[next[lengths[i]]++] = i;
+    }
+}
+
+/* Read a word list into memory with a single read and index it, so that
+ * picking a word for a new game never touches the file again. Words that
+ * do not fit in MAX_WORD are skipped.
+ */
+static int read_word_list(struct dictionary *dict, int fd, size_t file_size,
+                          char *filename) {
+    // One extra byte so the last word is terminated even without a '\n'.
+    char *words = malloc(file_size + 1);
+    if (words == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    size_t got = 0;
+    while (got < file_size) {
+        ssize_t n = read(fd, words + got, file_size - got);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == -1) {
+                perror("read");
+            }
+            break;
+        }
+        got += n;
+    }
+    words[got] = '\n';
+
+    // There can't be more words than lines.
+    int max_words = 1;
+    for (size_t i = 0; i < got; i++) {
+        if (words[i] == '\n') {
+            max_words++;
+        }
+    }
+    uint32_t *offsets = malloc(max_words * sizeof(uint32_t));
+    uint8_t *lengths = malloc(max_words);
+    uint32_t *masks = malloc(max_words * sizeof(uint32_t));
+    uint32_t *by_length = malloc(max_words * sizeof(uint32_t));
+    if (offsets == NULL || lengths == NULL || masks == NULL || by_length == NULL) {
+        perror("malloc");
+        free(words);
+        free(offsets);
+        free(lengths);
+        free(masks);
+        free(by_length);
+        return -1;
+    }
+
+    int count = 0;
+    int dos_endings = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= got; i++) {
+        if (words[i] != '\n') {
+            continue;
+        }
+        size_t len = i - start;
+        if (len > 0 && words[i - 1] == '\r') {
+            dos_endings = 1;
+            len--;
+        }
+        words[start + len] = '\0';
+        if (len > 0 && len < MAX_WORD) {
+            offsets[count] = start;
+            lengths[count] = len;
+            masks[count] = letter_mask(words + start, len);
+            count++;
+        }
+        start = i + 1;
+    }
+    if (dos_endings) {
+        fprintf(stderr, "The dictionary file does not appear to have Unix line endings\n");
+    }
+    if (count == 0) {
+        fprintf(stderr, "The dictionary %s has no usable words\n", filename);
+        free(words);
+        free(offsets);
+        free(lengths);
+        free(masks);
+        free(by_length);
+        return -1;
+    }
+    sort_by_length(lengths, count, dict->buckets, by_length);
+
+    dict->words = words;
+    dict->offsets = offsets;
+    dict->lengths = lengths;
+    dict->masks = masks;
+    dict->by_length = by_length;
+    dict->size = count;
+    dict->map = NULL;
+    dict->map_size = 0;
+    return count;
+}
+
+/* Return 1 if a section of n bytes at offset lies within a file of
+ * file_size bytes and is aligned to 8.
+ */
+static int section_fits(uint64_t offset, uint64_t n, uint64_t file_size) {
+    return offset % 8 == 0 && offset <= file_size && n <= file_size - offset;
+}
+
+/* Check that the mapped file is one dictc built for this server, and that
+ * nothing in it points outside it. Return what is wrong, or NULL.
+ */
+static const char *check_dictionary(const char *base, size_t file_size) {
+    const struct dict_header *h = (const struct dict_header *)base;
+    if (h->version != DICT_VERSION) {
+        return "unsupported version";
+    }
+    if (h->byte_order != DICT_BYTE_ORDER) {
+        return "built on a host with another byte order";
+    }
+    if (h->max_word != MAX_WORD) {
+        return "built for another MAX_WORD";
+    }
+    if (h->file_size != file_size) {
+        return "truncated";
+    }
+    uint64_t size = h->size;
+    if (size == 0 || size > INT_MAX) {
+        return "bad word count";
+    }
+    if (!section_fits(h->blob_offset, h->blob_size, file_size)
+            || !section_fits(h->offsets_offset, size * sizeof(uint32_t), file_size)
+            || !section_fits(h->lengths_offset, size, file_size)
+            || !section_fits(h->masks_offset, size * sizeof(uint32_t), file_size)
+            || !section_fits(h->by_length_offset, size * sizeof(uint32_t), file_size)) {
+        return "section out of bounds";
+    }
+
+    // Every word must lie within the blob and be terminated there.
+    const char *blob = base + h->blob_offset;
+    const uint32_t *offsets = (const uint32_t *)(base + h->offsets_offset);
+    const uint8_t *lengths = (const uint8_t *)(base + h->lengths_offset);
+    for (uint64_t i = 0; i < size; i++) {
+        uint64_t len = lengths[i];
+        if (len == 0 || len >= MAX_WORD || offsets[i] >= h->blob_size
+                || len >= h->blob_size - offsets[i]
+                || blob[offsets[i] + len] != '\0') {
+            return "bad word";
+        }
+    }
+
+    const uint32_t *by_length = (const uint32_t *)(base + h->by_length_offset);
+    if (h->buckets[0] != 0 || h->buckets[MAX_WORD] != size) {
+        return "bad length buckets";
+    }
+    for (int n = 0; n < MAX_WORD; n++) {
+        if (h->buckets[n] > h->buckets[n + 1]) {
+            return "bad length buckets";
+        }
+    }
+    for (int n = 0; n < MAX_WORD; n++) {
+        for (uint32_t j = h->buckets[n]; j < h->buckets[n + 1]; j++) {
+            if (by_length[j] >= size || lengths[by_length[j]] != n) {
+                return "bad length buckets";
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Map a dictc file and point dict into the mapping. */
+static int map_dictionary(struct dictionary *dict, int fd, size_t file_size,
+                          char *filename) {
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    const char *problem = check_dictionary(map, file_size);
+    if (problem != NULL) {
+        fprintf(stderr, "The dictionary %s can't be used: %s\n", filename, problem);
+        munmap(map, file_size);
+        return -1;
+    }
+
+    const char *base = map;
+    const struct dict_header *h = map;
+    dict->words = base + h->blob_offset;
+    dict->offsets = (const uint32_t *)(base + h->offsets_offset);
+    dict->lengths = (const uint8_t *)(base + h->lengths_offset);
+    dict->masks = (const uint32_t *)(base + h->masks_offset);
+    dict->by_length = (const uint32_t *)(base + h->by_length_offset);
+    memcpy(dict->buckets, h->buckets, sizeof(dict->buckets));
+    dict->size = h->size;
+    dict->map = map;
+    dict->map_size = file_size;
+    return dict->size;
+}
+
+int load_dictionary(struct dictionary *dict, char *filename) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+
+    char magic[sizeof(DICT_MAGIC) - 1];
+    int binary = st.st_size >= (off_t)sizeof(struct dict_header)
+        && pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+        && memcmp(magic, DICT_MAGIC, sizeof(magic)) == 0;
+
+    int res = binary ? map_dictionary(dict, fd, st.st_size, filename)
+                     : read_word_list(dict, fd, st.st_size, filename);
+    close(fd);
+    return res;
+}
+
+void free_dictionary(struct dictionary *dict) {
+    if (dict->map != NULL) {
+        munmap(dict->map, dict->map_size);
+        return;
+    }
+    // A word list's tables are ours, whatever the const says to readers.
+    free((char *)dict->words);
+    free((uint32_t *)dict->offsets);
+    free((uint8_t *)dict->lengths);
+    free((uint32_t *)dict->masks);
+    free((uint32_t *)dict->by_length);
+}
+
+/* Pad f with zeros up to offset, then write the n bytes at p there. */
+static int put_section(FILE *f, uint64_t offset, const void *p, size_t n) {
+    long pos = ftell(f);
+    while (pos >= 0 && (uint64_t)pos < offset) {
+        if (fputc(0, f) == EOF) {
+            return -1;
+        }
+        pos++;
+    }
+    return fwrite(p, 1, n, f) == n ? 0 : -1;
+}
+
+int save_dictionary(const struct dictionary *dict, const char *filename) {
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", filename) >= (int)sizeof(tmp)) {
+        fprintf(stderr, "%s: file name too long\n", filename);
+        return -1;
+    }
+
+    // The words are packed back to back, whatever was between them before.
+    uint32_t *offsets = malloc(dict->size * sizeof(uint32_t));
+    if (offsets == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    uint64_t blob_size = 0;
+    for (int i = 0; i < dict->size; i++) {
+        offsets[i] = blob_size;
+        blob_size += dict->lengths[i] + 1;
+    }
+
+    struct dict_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DICT_MAGIC, sizeof(h.magic));
+    h.version = DICT_VERSION;
+    h.byte_order = DICT_BYTE_ORDER;
+    h.max_word = MAX_WORD;
+    h.size = dict->size;
+    memcpy(h.buckets, dict->buckets, sizeof(h.buckets));
+    h.blob_offset = ALIGN8(sizeof(h));
+    h.blob_size = blob_size;
+    h.offsets_offset = ALIGN8(h.blob_offset + blob_size);
+    h.lengths_offset = ALIGN8(h.offsets_offset + dict->size * sizeof(uint32_t));
+    h.masks_offset = ALIGN8(h.lengths_offset + dict->size);
+    h.by_length_offset = ALIGN8(h.masks_offset + dict->size * sizeof(uint32_t));
+    h.file_size = h.by_length_offset + dict->size * sizeof(uint32_t);
+
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL) {
+        perror("fopen");
+        free(offsets);
+        return -1;
+    }
+    int res = put_section(f, 0, &h, sizeof(h));
+    for (int i = 0; i < dict->size && res == 0; i++) {
+        res = put_section(f, h.blob_offset + offsets[i],
+                          dict->words + dict->offsets[i], dict->lengths[i] + 1);
+    }
+    if (res == 0) {
+        res = put_section(f, h.offsets_offset, offsets, dict->size * sizeof(uint32_t));
+    }
+    if (res == 0) {
+        res = put_section(f, h.lengths_offset, dict->lengths, dict->size);
+    }
+    if (res == 0) {
+        res = put_section(f, h.masks_offset, dict->masks, dict->size * sizeof(uint32_t));
+    }
+    if (res == 0) {
+        res = put_section(f, h.by_length_offset, dict->by_length,
+                          dict->size * sizeof(uint32_t));
+    }
+    free(offsets);
+    if (res == -1 || fflush(f) == EOF || fsync(fileno(f)) == -1) {
+        perror(tmp);
+        fclose(f);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(f);
+    if (rename(tmp, filename) == -1) {
+        perror("rename");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
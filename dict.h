@@ -0,0 +1,70 @@
+#ifndef _DICT_H_
+#define _DICT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAX_WORD 20               // must stay within the bits of a uint32_t
+
+/* The words games are played with. A dictionary comes either from a word
+ * list, one word per line, parsed at startup, or from a binary file built
+ * from one by dictc and mapped read-only as it is: nothing is parsed or
+ * copied, and every process using the file shares one copy of it in the
+ * page cache.
+ *
+ * Word i starts at words + offsets[i] and is lengths[i] characters long
+ * (plus a terminating '\0'). Words too long for MAX_WORD are left out.
+ */
+struct dictionary {
+    const char *words;
+    const uint32_t *offsets;
+    const uint8_t *lengths;
+    const uint32_t *masks;        // the letters in each word, bit i for 'a' + i
+    const uint32_t *by_length;    // word indices, shortest words first
+    uint32_t buckets[MAX_WORD + 1];   // words of length n are by_length[buckets[n]]
+                                      // up to (not including) by_length[buckets[n + 1]]
+    int size;
+
+    void *map;                    // the mapped file, or NULL for a word list
+    size_t map_size;
+};
+
+/* The binary format, in the byte order of the host that built it. The
+ * header is followed by the sections it points to; each is aligned to 8
+ * bytes and holds size entries of the same type as in struct dictionary,
+ * except blob, which holds the '\0'-terminated words back to back.
+ */
+#define DICT_MAGIC "WORDDICT"     // 8 bytes, not terminated in the file
+#define DICT_VERSION 1
+#define DICT_BYTE_ORDER 0x01020304
+
+struct dict_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;          // DICT_BYTE_ORDER as the builder wrote it
+    uint32_t max_word;            // MAX_WORD of the builder
+    uint32_t size;                // number of words
+    uint32_t buckets[MAX_WORD + 1];
+    uint64_t blob_offset;
+    uint64_t blob_size;
+    uint64_t offsets_offset;
+    uint64_t lengths_offset;
+    uint64_t masks_offset;
+    uint64_t by_length_offset;
+    uint64_t file_size;
+};
+
+/* Load the words of filename into dict: a dictc file is mapped, anything
+ * else is read as a word list. Return the number of words, or -1 if the
+ * file can't be loaded.
+ */
+int load_dictionary(struct dictionary *dict, char *filename);
+/* Free what load_dictionary allocated or mapped for dict. */
+void free_dictionary(struct dictionary *dict);
+/* Write dict to filename in the binary format. The file is written under
+ * a temporary name and renamed into place, so servers that have the old
+ * file mapped keep a consistent copy. Returns -1 on failure.
+ */
+int save_dictionary(const struct dictionary *dict, const char *filename);
+
+#endif
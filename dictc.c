@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dict.h"
+
+/* Compiles a word list (one word per line) into the binary dictionary
+ * format of dict.h. wordsrv and wordsim take either file; the binary one
+ * is mapped as it is instead of being read and parsed at every start.
+ */
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <word list> <output file>\n", argv[0]);
+        exit(1);
+    }
+
+    struct dictionary dict;
+    if (load_dictionary(&dict, argv[1]) == -1) {
+        exit(1);
+    }
+    if (save_dictionary(&dict, argv[2]) == -1) {
+        exit(1);
+    }
+
+    // Read the result back the way the server will, so a bad file is
+    // caught here rather than at startup.
+    struct dictionary check;
+    if (load_dictionary(&check, argv[2]) == -1 || check.map == NULL
+            || check.size != dict.size) {
+        fprintf(stderr, "%s did not read back as written\n", argv[2]);
+        exit(1);
+    }
+    printf("%s: %d words, %zu bytes\n", argv[2], check.size, check.map_size);
+    return 0;
+}
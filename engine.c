@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "engine.h"
+
+/* Initialize the gameboard for the len letters of word:
+ *    - set guess to all dashes ('-')
+ *    - note where each letter of the word is, so a guess never has to
+ *      look at the word again
+ *    - initialize the other fields
+ */
+static void set_word(struct game *g, const char *word, int len) {
+    memcpy(g->word, word, len);
+    g->word[len] = '\0';
+    memset(g->guess, '-', len);
+    g->guess[len] = '\0';
+
+    memset(g->positions, 0, sizeof(g->positions));
+    g->in_word = 0;
+    for (int i = 0; i < len; i++) {
+        // Anything but a lowercase letter can't be guessed and stays hidden.
+        if (g->word[i] >= 'a' && g->word[i] <= 'z') {
+            g->positions[g->word[i] - 'a'] |= 1U << i;
+            g->in_word |= 1U << (g->word[i] - 'a');
+        }
+    }
+    g->all = (1U << len) - 1;
+    g->revealed = 0;
+    g->letters_guessed = 0;
+    g->guesses_left = MAX_GUESSES;
+}
+
+void engine_new_game(struct game *g, const struct dictionary *dict, int index) {
+    set_word(g, dict->words + dict->offsets[index], dict->lengths[index]);
+}
+
+int engine_resume_game(struct game *g, const char *word, uint32_t letters_guessed,
+                       int guesses_left) {
+    int len = strnlen(word, MAX_WORD);
+    if (len == 0 || len == MAX_WORD || letters_guessed >> NUM_LETTERS != 0
+            || guesses_left < 1 || guesses_left > MAX_GUESSES) {
+        return -1;
+    }
+    // Every guess, hit or miss, costs one: more letters than that could not
+    // have been guessed in this game, and would not fit in status_message.
+    if (__builtin_popcount(letters_guessed) != MAX_GUESSES - guesses_left) {
+        return -1;
+    }
+    struct game resumed;
+    set_word(&resumed, word, len);
+    for (uint32_t left = letters_guessed; left != 0; left &= left - 1) {
+        uint32_t found = resumed.positions[__builtin_ctz(left)];
+        resumed.revealed |= found;
+        for (; found != 0; found &= found - 1) {
+            resumed.guess[__builtin_ctz(found)] = resumed.word[__builtin_ctz(found)];
+        }
+    }
+    // A game every letter of which was guessed is over.
+    if (resumed.revealed == resumed.all) {
+        return -1;
+    }
+    resumed.letters_guessed = letters_guessed;
+    resumed.guesses_left = guesses_left;
+    *g = resumed;
+    return 0;
+}
+
+enum guess_result engine_guess(struct game *g, const char *line,
+                               struct guess_outcome *out) {
+    out->letter = line[0];
+    out->at = 0;
+    out->end = GAME_ON;
+
+    // Anything but exactly one lowercase letter.
+    if (line[0] < 'a' || line[0] > 'z' || line[1] != '\0') {
+        return out->result = GUESS_INVALID;
+    }
+    uint32_t letter = 1U << (line[0] - 'a');
+    if (g->letters_guessed & letter) {
+        return out->result = GUESS_REPEATED;
+    }
+    g->letters_guessed |= letter;
+    g->guesses_left--;
+    if (!(g->in_word & letter)) {
+        out->result = GUESS_MISS;
+    } else {
+        // Reveal only the positions the letter occupies.
+        uint32_t found = g->positions[line[0] - 'a'];
+        out->at = found;
+        g->revealed |= found;
+        for (; found != 0; found &= found - 1) {
+            g->guess[__builtin_ctz(found)] = line[0];
+        }
+        out->result = GUESS_HIT;
+    }
+
+    // The game ends when a player guesses the last hidden letter, or when
+    // the players have zero guesses remaining.
+    if (g->revealed == g->all) {
+        out->end = GAME_WON;
+    } else if (g->guesses_left == 0) {
+        out->end = GAME_LOST;
+    }
+    return out->result;
+}
+
+/* Return a status message that shows the current state of the game.
+ * Assumes that the caller has allocated MAX_MSG bytes for msg.
+ */
+char *status_message(char *msg, const struct game *g) {
+    int len = sprintf(msg, "***************\r\n"
+           "Word to guess: %s\r\nGuesses remaining: %d\r\n"
+           "Letters guessed: \r\n", g->guess, g->guesses_left);
+    for (uint32_t left = g->letters_guessed; left != 0; left &= left - 1) {
+        msg[len++] = (char)('a' + __builtin_ctz(left));
+        msg[len++] = ' ';
+    }
+    strcpy(msg + len, "\r\n***************\r\n");
+    return msg;
+}
+
@@ -0,0 +1,71 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+/* The rules of the game, with no sockets, clients or rooms: a game state
+ * and a guess go in, the new state and what happened come out, and the
+ * caller decides who gets told what. The server and the simulator (see
+ * wordsim.c) both play through this.
+ */
+
+#include <stdint.h>
+
+#include "dict.h"
+
+#define MAX_GUESSES 4
+#define NUM_LETTERS 26
+#define MAX_MSG 128
+
+// The gameboard of one game. Letters and positions in the word are kept
+// as bitmasks: bit i of a letter mask stands for 'a' + i, and bit i of a
+// position mask for word[i].
+struct game {
+    char word[MAX_WORD];      // The word to guess
+    char guess[MAX_WORD];     // The current guess (for example '-o-d')
+    uint32_t positions[NUM_LETTERS];  // Where each letter occurs in word
+    uint32_t in_word;         // Letters that occur in word
+    uint32_t letters_guessed; // Letters guessed so far
+    uint32_t revealed;        // Positions of guess no longer shown as '-'
+    uint32_t all;             // Every position of word; revealed == all wins
+    int guesses_left;         // Number of guesses remaining
+};
+
+enum guess_result {
+    GUESS_INVALID,            // not a single lowercase letter
+    GUESS_REPEATED,           // the letter was guessed before in this game
+    GUESS_HIT,                // the letter is in the word
+    GUESS_MISS                // the letter is not in the word; the turn passes
+};
+
+enum game_end {
+    GAME_ON,
+    GAME_WON,                 // the guess revealed the last hidden letter
+    GAME_LOST                 // no guesses are left
+};
+
+/* What one guess did. Only HIT and MISS change the game. */
+struct guess_outcome {
+    enum guess_result result;
+    char letter;
+    uint32_t at;              // positions the letter revealed, bit i for word[i]
+    enum game_end end;
+};
+
+/* Start a new game on g with word index of dict. */
+void engine_new_game(struct game *g, const struct dictionary *dict, int index);
+/* Carry on a game of word in which the letters in letters_guessed were
+ * guessed and guesses_left remain, as a snapshot saved it. Returns -1,
+ * leaving g alone, if that is not a game that could still be going on.
+ */
+int engine_resume_game(struct game *g, const char *word, uint32_t letters_guessed,
+                       int guesses_left);
+/* Apply the line a player sent on their turn to g and describe the result
+ * in out. Returns out->result.
+ */
+enum guess_result engine_guess(struct game *g, const char *line,
+                               struct guess_outcome *out);
+/* Return a status message that shows the current state of the game.
+ * Assumes that the caller has allocated MAX_MSG bytes for msg.
+ */
+char *status_message(char *msg, const struct game *g);
+
+#endif
@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include "event.h"
+#include "uring.h"
+
+
+/* ---------------------------------------------------------------------
+ * epoll backend: edge-triggered when asked to be, O(ready) per wait.
+ */
+
+struct epoll_impl {
+    int epfd;
+    struct epoll_event events[MAX_EVENTS];
+};
+
+static unsigned int to_epoll(int events) {
+    unsigned int e = 0;
+    if (events & EV_READ) {
+        e |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & EV_WRITE) {
+        e |= EPOLLOUT;
+    }
+    if (events & EV_EDGE) {
+        e |= EPOLLET;
+    }
+    return e;
+}
+
+static int epoll_init(struct event_loop *loop) {
+    struct epoll_impl *ep = malloc(sizeof(struct epoll_impl));
+    if (ep == NULL) {
+        return -1;
+    }
+    ep->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ep->epfd < 0) {
+        free(ep);
+        return -1;
+    }
+    loop->impl = ep;
+    return 0;
+}
+
+static int epoll_ctl_fd(struct event_loop *loop, int op, int fd, int events) {
+    struct epoll_impl *ep = loop->impl;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = to_epoll(events);
+    ev.data.fd = fd;
+    return epoll_ctl(ep->epfd, op, fd, &ev);
+}
+
+static int epoll_add(struct event_loop *loop, int fd, int events) {
+    return epoll_ctl_fd(loop, EPOLL_CTL_ADD, fd, events);
+}
+
+static int epoll_mod(struct event_loop *loop, int fd, int events) {
+    return epoll_ctl_fd(loop, EPOLL_CTL_MOD, fd, events);
+}
+
+static int epoll_del(struct event_loop *loop, int fd) {
+    return epoll_ctl_fd(loop, EPOLL_CTL_DEL, fd, 0);
+}
+
+static int epoll_wait_fds(struct event_loop *loop, struct event *ready,
+                          int max, int timeout_ms) {
+    struct epoll_impl *ep = loop->impl;
+    if (max > MAX_EVENTS) {
+        max = MAX_EVENTS;
+    }
+    int n = epoll_wait(ep->epfd, ep->events, max, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        unsigned int e = ep->events[i].events;
+        ready[i].fd = ep->events[i].data.fd;
+        ready[i].events = 0;
+        if (e & (EPOLLIN | EPOLLRDHUP)) {
+            ready[i].events |= EV_READ;
+        }
+        if (e & EPOLLOUT) {
+            ready[i].events |= EV_WRITE;
+        }
+        if (e & (EPOLLERR | EPOLLHUP)) {
+            ready[i].events |= EV_ERROR | EV_READ;
+        }
+    }
+    return n;
+}
+
+static void epoll_destroy(struct event_loop *loop) {
+    struct epoll_impl *ep = loop->impl;
+    close(ep->epfd);
+    free(ep);
+}
+
+static const struct event_backend epoll_backend = {
+    "epoll", epoll_init, epoll_add, epoll_mod, epoll_del, epoll_wait_fds,
+    epoll_destroy
+};
+
+
+/* ---------------------------------------------------------------------
+ * poll backend: portable fallback. Always level-triggered: a descriptor
+ * with input left unread is reported on every wait. Callers drain client
+ * sockets until EAGAIN, and a throttled client, whose input is left
+ * unread on purpose, is not watched for input until it may read on.
+ */
+
+struct poll_impl {
+    struct pollfd *fds;       // densely packed set passed to poll
+    int nfds;
+    int cap;
+    int *index;               // index[fd] is the slot of fd in fds, or -1
+    int index_cap;
+};
+
+static short to_poll(int events) {
+    short e = 0;
+    if (events & EV_READ) {
+        e |= POLLIN;
+    }
+    if (events & EV_WRITE) {
+        e |= POLLOUT;
+    }
+    return e;
+}
+
+static int poll_init(struct event_loop *loop) {
+    struct poll_impl *pi = calloc(1, sizeof(struct poll_impl));
+    if (pi == NULL) {
+        return -1;
+    }
+    loop->impl = pi;
+    return 0;
+}
+
+static int poll_add(struct event_loop *loop, int fd, int events) {
+    struct poll_impl *pi = loop->impl;
+    if (fd >= pi->index_cap) {
+        int cap = pi->index_cap ? pi->index_cap : 64;
+        while (cap <= fd) {
+            cap *= 2;
+        }
+        int *index = realloc(pi->index, cap * sizeof(int));
+        if (index == NULL) {
+            return -1;
+        }
+        for (int i = pi->index_cap; i < cap; i++) {
+            index[i] = -1;
+        }
+        pi->index = index;
+        pi->index_cap = cap;
+    }
+    if (pi->index[fd] != -1) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (pi->nfds == pi->cap) {
+        int cap = pi->cap ? pi->cap * 2 : 64;
+        struct pollfd *fds = realloc(pi->fds, cap * sizeof(struct pollfd));
+        if (fds == NULL) {
+            return -1;
+        }
+        pi->fds = fds;
+        pi->cap = cap;
+    }
+    pi->fds[pi->nfds].fd = fd;
+    pi->fds[pi->nfds].events = to_poll(events);
+    pi->fds[pi->nfds].revents = 0;
+    pi->index[fd] = pi->nfds++;
+    return 0;
+}
+
+static int poll_mod(struct event_loop *loop, int fd, int events) {
+    struct poll_impl *pi = loop->impl;
+    if (fd < 0 || fd >= pi->index_cap || pi->index[fd] == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+    pi->fds[pi->index[fd]].events = to_poll(events);
+    return 0;
+}
+
+static int poll_del(struct event_loop *loop, int fd) {
+    struct poll_impl *pi = loop->impl;
+    if (fd < 0 || fd >= pi->index_cap || pi->index[fd] == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+    // Move the last entry into the hole to keep the array dense.
+    int slot = pi->index[fd];
+    pi->nfds--;
+    if (slot != pi->nfds) {
+        pi->fds[slot] = pi->fds[pi->nfds];
+        pi->index[pi->fds[slot].fd] = slot;
+    }
+    pi->index[fd] = -1;
+    return 0;
+}
+
+static int poll_wait_fds(struct event_loop *loop, struct event *ready,
+                         int max, int timeout_ms) {
+    struct poll_impl *pi = loop->impl;
+    int nready = poll(pi->fds, pi->nfds, timeout_ms);
+    if (nready <= 0) {
+        return nready;
+    }
+    int n = 0;
+    for (int i = 0; i < pi->nfds && n < max && nready > 0; i++) {
+        short e = pi->fds[i].revents;
+        if (e == 0) {
+            continue;
+        }
+        nready--;
+        ready[n].fd = pi->fds[i].fd;
+        ready[n].events = 0;
+        if (e & POLLIN) {
+            ready[n].events |= EV_READ;
+        }
+        if (e & POLLOUT) {
+            ready[n].events |= EV_WRITE;
+        }
+        if (e & (POLLERR | POLLHUP | POLLNVAL)) {
+            ready[n].events |= EV_ERROR | EV_READ;
+        }
+        n++;
+    }
+    return n;
+}
+
+static void poll_destroy(struct event_loop *loop) {
+    struct poll_impl *pi = loop->impl;
+    free(pi->fds);
+    free(pi->index);
+    free(pi);
+}
+
+static const struct event_backend poll_backend = {
+    "poll", poll_init, poll_add, poll_mod, poll_del, poll_wait_fds,
+    poll_destroy
+};
+
+
+/* ---------------------------------------------------------------------
+ * io_uring backend: readiness comes from poll requests in a ring, and
+ * adding, changing and removing them are queued there too, so they cost
+ * no system call of their own: everything goes to the kernel with the
+ * next wait. Edge-triggered descriptors get one multishot poll that
+ * reports every wakeup; the others get a one-shot poll that is armed
+ * again after each report, which checks readiness afresh just as a
+ * level-triggered wait would.
+ */
+
+#define URING_ENTRIES 1024
+#define URING_CQ_ENTRIES 16384
+#define URING_IGNORE UINT64_MAX   // user_data of requests nobody waits for
+
+struct uring_fd {
+    int watched;              // added and not deleted since
+    int events;               // as given to add or mod
+    int armed;                // a poll request is queued or in the kernel
+    unsigned int gen;         // changes whenever the old request goes stale
+};
+
+struct uring_impl {
+    struct uring ring;
+    struct uring_fd *fds;     // indexed by descriptor
+    int cap;
+};
+
+/* A poll request is tagged with its descriptor and generation, so reports
+ * from one that was removed or replaced are recognized and dropped.
+ */
+static uint64_t uring_tag(int fd, unsigned int gen) {
+    return (uint64_t)gen << 32 | (unsigned int)fd;
+}
+
+static int uring_init_loop(struct event_loop *loop) {
+    struct uring_impl *ui = calloc(1, sizeof(struct uring_impl));
+    if (ui == NULL) {
+        return -1;
+    }
+    if (uring_init(&ui->ring, URING_ENTRIES, URING_CQ_ENTRIES) == -1) {
+        free(ui);
+        return -1;
+    }
+    loop->impl = ui;
+    return 0;
+}
+
+static int uring_arm(struct uring_impl *ui, int fd) {
+    struct uring_fd *f = &ui->fds[fd];
+    struct io_uring_sqe *sqe = uring_sqe(&ui->ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = to_epoll(f->events & (EV_READ | EV_WRITE));
+    sqe->len = (f->events & EV_EDGE) ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = uring_tag(fd, f->gen);
+    f->armed = 1;
+    return 0;
+}
+
+static int uring_disarm(struct uring_impl *ui, int fd) {
+    struct uring_fd *f = &ui->fds[fd];
+    if (f->armed) {
+        struct io_uring_sqe *sqe = uring_sqe(&ui->ring);
+        if (sqe == NULL) {
+            return -1;
+        }
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = uring_tag(fd, f->gen);
+        sqe->user_data = URING_IGNORE;
+        f->armed = 0;
+    }
+    f->gen++;
+    return 0;
+}
+
+static int uring_add(struct event_loop *loop, int fd, int events) {
+    struct uring_impl *ui = loop->impl;
+    if (fd >= ui->cap) {
+        int cap = ui->cap ? ui->cap : 64;
+        while (cap <= fd) {
+            cap *= 2;
+        }
+        struct uring_fd *fds = realloc(ui->fds, cap * sizeof(struct uring_fd));
+        if (fds == NULL) {
+            return -1;
+        }
+        memset(fds + ui->cap, 0, (cap - ui->cap) * sizeof(struct uring_fd));
+        ui->fds = fds;
+        ui->cap = cap;
+    }
+    if (ui->fds[fd].watched) {
+        errno = EEXIST;
+        return -1;
+    }
+    ui->fds[fd].watched = 1;
+    ui->fds[fd].events = events;
+    ui->fds[fd].gen++;
+    return uring_arm(ui, fd);
+}
+
+static int uring_mod(struct event_loop *loop, int fd, int events) {
+    struct uring_impl *ui = loop->impl;
+    if (fd < 0 || fd >= ui->cap || !ui->fds[fd].watched) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (uring_disarm(ui, fd) == -1) {
+        return -1;
+    }
+    ui->fds[fd].events = events;
+    return uring_arm(ui, fd);
+}
+
+static int uring_del(struct event_loop *loop, int fd) {
+    struct uring_impl *ui = loop->impl;
+    if (fd < 0 || fd >= ui->cap || !ui->fds[fd].watched) {
+        errno = ENOENT;
+        return -1;
+    }
+    ui->fds[fd].watched = 0;
+    return uring_disarm(ui, fd);
+}
+
+static int uring_wait_fds(struct event_loop *loop, struct event *ready,
+                          int max, int timeout_ms) {
+    struct uring_impl *ui = loop->impl;
+    struct uring *r = &ui->ring;
+
+    // Hand over what was queued since the last wait, and sleep only if
+    // there is nothing to report yet.
+    int wait_nr = (uring_cqe(r) == NULL && timeout_ms != 0) ? 1 : 0;
+    if ((wait_nr > 0 || r->sq_queued > 0) && uring_enter(r, wait_nr, timeout_ms) == -1) {
+        if (errno == ETIME) {
+            return 0;
+        }
+        if (errno != EBUSY) {
+            return -1;
+        }
+    }
+
+    int n = 0;
+    struct io_uring_cqe *cqe;
+    while (n < max && (cqe = uring_cqe(r)) != NULL) {
+        uint64_t tag = cqe->user_data;
+        int res = cqe->res;
+        unsigned int flags = cqe->flags;
+        uring_cqe_seen(r);
+
+        int fd = (int)(tag & 0xffffffff);
+        if (tag == URING_IGNORE || fd >= ui->cap || !ui->fds[fd].watched
+                || uring_tag(fd, ui->fds[fd].gen) != tag) {
+            continue;
+        }
+        if (!(flags & IORING_CQE_F_MORE)) {
+            // One-shot, or a multishot poll the kernel ended: arm it again,
+            // unless it failed. The request goes in with the next wait,
+            // after this report has been handled.
+            ui->fds[fd].armed = 0;
+            if (res >= 0) {
+                uring_arm(ui, fd);
+            }
+        }
+
+        ready[n].fd = fd;
+        ready[n].events = 0;
+        if (res < 0) {
+            ready[n].events = EV_ERROR | EV_READ;
+        } else {
+            if (res & (EPOLLIN | EPOLLRDHUP)) {
+                ready[n].events |= EV_READ;
+            }
+            if (res & EPOLLOUT) {
+                ready[n].events |= EV_WRITE;
+            }
+            if (res & (EPOLLERR | EPOLLHUP)) {
+                ready[n].events |= EV_ERROR | EV_READ;
+            }
+        }
+        n++;
+    }
+    return n;
+}
+
+static void uring_destroy(struct event_loop *loop) {
+    struct uring_impl *ui = loop->impl;
+    uring_free(&ui->ring);
+    free(ui->fds);
+    free(ui);
+}
+
+static const struct event_backend uring_backend = {
+    "uring", uring_init_loop, uring_add, uring_mod, uring_del, uring_wait_fds,
+    uring_destroy
+};
+
+
+/* ---------------------------------------------------------------------
+ * Generic front end.
+ */
+
+/* Backends in order of preference. io_uring has to be asked for. */
+static const struct event_backend *backends[] = {
+    &epoll_backend,
+    &poll_backend,
+    &uring_backend,
+    NULL
+};
+
+struct event_loop *event_loop_create(const char *backend) {
+    struct event_loop *loop = malloc(sizeof(struct event_loop));
+    if (loop == NULL) {
+        return NULL;
+    }
+    for (int i = 0; backends[i] != NULL; i++) {
+        if (backend != NULL && strcmp(backend, backends[i]->name) != 0) {
+            continue;
+        }
+        loop->backend = backends[i];
+        if (backends[i]->init(loop) == 0) {
+            return loop;
+        }
+        if (backend != NULL) {
+            break;
+        }
+    }
+    free(loop);
+    return NULL;
+}
+
+void event_loop_destroy(struct event_loop *loop) {
+    loop->backend->destroy(loop);
+    free(loop);
+}
+
+int event_add(struct event_loop *loop, int fd, int events) {
+    return loop->backend->add(loop, fd, events);
+}
+
+int event_mod(struct event_loop *loop, int fd, int events) {
+    return loop->backend->mod(loop, fd, events);
+}
+
+int event_del(struct event_loop *loop, int fd) {
+    return loop->backend->del(loop, fd);
+}
+
+int event_wait(struct event_loop *loop, struct event *ready, int max,
+               int timeout_ms) {
+    return loop->backend->wait(loop, ready, max, timeout_ms);
+}
@@ -0,0 +1,55 @@
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+/* Readiness flags reported for (and requested on) a descriptor. */
+#define EV_READ   0x1
+#define EV_WRITE  0x2
+#define EV_ERROR  0x4     // hang-up or error; only ever reported
+#define EV_EDGE   0x8     // request edge-triggered notification if supported
+
+#define MAX_EVENTS 256    // events returned by one call to event_wait
+
+/* One ready descriptor as returned by event_wait. */
+struct event {
+    int fd;
+    int events;
+};
+
+struct event_loop;
+
+/* The operations every event loop backend has to provide. */
+struct event_backend {
+    const char *name;
+    int (*init)(struct event_loop *loop);
+    int (*add)(struct event_loop *loop, int fd, int events);
+    int (*mod)(struct event_loop *loop, int fd, int events);
+    int (*del)(struct event_loop *loop, int fd);
+    int (*wait)(struct event_loop *loop, struct event *ready, int max,
+                int timeout_ms);
+    void (*destroy)(struct event_loop *loop);
+};
+
+struct event_loop {
+    const struct event_backend *backend;
+    void *impl;               // backend specific state
+};
+
+/* Create an event loop using the named backend ("epoll", "poll" or "uring").
+ * A NULL name picks the best backend available on this system.
+ * Returns NULL if the backend is unknown or could not be initialized.
+ */
+struct event_loop *event_loop_create(const char *backend);
+void event_loop_destroy(struct event_loop *loop);
+
+int event_add(struct event_loop *loop, int fd, int events);
+int event_mod(struct event_loop *loop, int fd, int events);
+int event_del(struct event_loop *loop, int fd);
+
+/* Wait up to timeout_ms (-1 for no timeout) for descriptors to become ready
+ * and store at most max of them in ready. Returns the number of ready
+ * descriptors, 0 on timeout, or -1 on error (errno is set).
+ */
+int event_wait(struct event_loop *loop, struct event *ready, int max,
+               int timeout_ms);
+
+#endif
@@ -2,95 +2,86 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "gameplay.h"
+#include "log.h"
 
-/* Return a status message that shows the current state of the game.
- * Assumes that the caller has allocated MAX_MSG bytes for msg.
+/* Return the status message of game as a shared message, rendering it only
+ * if the game changed since it was last asked for. The game keeps the
+ * reference; callers that keep the message must take their own.
+ * Returns NULL if out of memory.
  */
-char *status_message(char *msg, struct game_state *game) {
-    sprintf(msg, "***************\r\n"
-           "Word to guess: %s\r\nGuesses remaining: %d\r\n"
-           "Letters guessed: \r\n", game->guess, game->guesses_left);
-    for(int i = 0; i < 26; i++){
-        if(game->letters_guessed[i]) {
-            int len = strlen(msg);
-            msg[len] = (char)('a' + i);
-            msg[len + 1] = ' ';
-            msg[len + 2] = '\0';
-        }
+struct msg *status_banner(struct game_state *game) {
+    if (game->status == NULL) {
+        char buf[MAX_MSG];
+        status_message(buf, &game->board);
+        game->status = msg_new(buf, strlen(buf));
     }
-    strncat(msg, "\r\n***************\r\n", MAX_MSG);
-    return msg;
+    return game->status;
 }
 
-
-/* Initialize the gameboard: 
- *    - initialize dictionary
- *    - select a random word to guess from the dictionary file
- *    - set guess to all dashes ('-')
- *    - initialize the other fields
- * We can't initialize head and has_next_turn because these will have
- * different values when we use init_game to create a new game after one
- * has already been played
- */
-void init_game(struct game_state *game, char *dict_name) {
-    char buf[MAX_WORD];
-    if(game->dict.fp != NULL) {
-        rewind(game->dict.fp);
-    } else {
-        game->dict.fp = fopen(dict_name, "r");
-        if(game->dict.fp == NULL) {
-            perror("Opening dictionary");
-            exit(1);
-        }
-    } 
-
-    int index = random() % game->dict.size;
-    printf("Looking for word at index %d\n", index);
-    for(int i = 0; i <= index; i++) {
-        if(!fgets(buf, MAX_WORD, game->dict.fp)){
-            fprintf(stderr,"File ended before we found the entry index %d",index);
-            exit(1);
+/* The delta protocol's "state" line for game, cached like status_banner. */
+struct msg *delta_state(struct game_state *game) {
+    if (game->delta == NULL) {
+        char buf[MAX_MSG];
+        int len = sprintf(buf, "state word=%s guesses=%d letters=",
+                          game->board.guess, game->board.guesses_left);
+        for (uint32_t left = game->board.letters_guessed; left != 0; left &= left - 1) {
+            buf[len++] = (char)('a' + __builtin_ctz(left));
         }
-    } 
-
-    // Found word
-    if(buf[strlen(buf) - 1] == '\n') {  // from a unix file
-        buf[strlen(buf) - 1] = '\0';
-    } else {
-        fprintf(stderr, "The dictionary file does not appear to have Unix line endings\n");
-    }
-    strncpy(game->word, buf, MAX_WORD);
-    game->word[MAX_WORD-1] = '\0';
-    for(int j = 0; j < strlen(game->word); j++) {
-        game->guess[j] = '-';
+        len += sprintf(buf + len, "\r\n");
+        game->delta = msg_new(buf, len);
     }
-    game->guess[strlen(game->word)] = '\0';
+    return game->delta;
+}
 
-    for(int i = 0; i < NUM_LETTERS; i++) {
-        game->letters_guessed[i] = 0;
+char *delta_guess(char *buf, const struct game *g, const struct guess_outcome *out,
+                  const char *player) {
+    if (out->result == GUESS_MISS) {
+        sprintf(buf, "miss letter=%c guesses=%d player=%s\r\n",
+                out->letter, g->guesses_left, player);
+        return buf;
+    }
+    int len = sprintf(buf, "reveal letter=%c at=", out->letter);
+    for (uint32_t at = out->at; at != 0; at &= at - 1) {
+        len += sprintf(buf + len, "%d%s", __builtin_ctz(at), (at & (at - 1)) ? "," : "");
     }
-    game->guesses_left = MAX_GUESSES;
+    sprintf(buf + len, " guesses=%d player=%s\r\n", g->guesses_left, player);
+    return buf;
+}
 
+/* Note that the guess, the letters guessed or the guesses left changed, so
+ * the status banner has to be rendered again.
+ */
+void game_changed(struct game_state *game) {
+    msg_release(game->status);
+    game->status = NULL;
+    msg_release(game->delta);
+    game->delta = NULL;
 }
 
 
-/* Return the number of lines in the file
+/* Start a new game with a random word from the dictionary, one
+ * word_length letters long unless that is 0 or the dictionary has no such
+ * words. We can't initialize head and has_next_turn because these will have
+ * different values when we use init_game to create a new game after one
+ * has already been played. status must be NULL or a message the first time.
+ * The game copies its word, so it does not need dict once this returns.
  */
-int get_file_length(char *filename) {
-    char buf[MAX_MSG];
-    int count = 0;
-    FILE *fp;
-    if((fp = fopen(filename, "r")) == NULL) {
-        perror("open");
-        exit(1);
-    }
-    
-    while(fgets(buf, MAX_MSG, fp) != NULL) {
-        count++;
+void init_game(struct game_state *game, struct dictionary *dict, int word_length) {
+
+    int index = random() % dict->size;
+    if (word_length > 0 && word_length < MAX_WORD) {
+        uint32_t first = dict->buckets[word_length];
+        uint32_t count = dict->buckets[word_length + 1] - first;
+        if (count > 0) {
+            index = dict->by_length[first + random() % count];
+        }
     }
-    
-    fclose(fp);
-    return count;
+    log_debug("word_picked", LF_INT("index", index));
+    engine_new_game(&game->board, dict, index);
+    game_changed(game);
 }
@@ -1,42 +1,114 @@
+#ifndef _GAMEPLAY_H_
+#define _GAMEPLAY_H_
+
 #include <netinet/in.h>
 
+#include "outq.h"
+#include "linebuf.h"
+#include "engine.h"
+#include "timer.h"
+
 #define MAX_NAME 30  
-#define MAX_MSG 128
-#define MAX_WORD 20
 #define MAX_BUF 256
-#define MAX_GUESSES 4
-#define NUM_LETTERS 26
 #define WELCOME_MSG "Welcome to our word game. What is your name? "
 #define INVALID_LETTER "Invalid letter, guess again? "
 
+struct room;
+
+/* How a client is spoken to. Everyone starts with the text meant for
+ * people on telnet. A client that sends DELTA_HELLO instead of its name
+ * gets short lines of key=value fields instead, each saying only what
+ * changed; a name, which may contain spaces, always comes last:
+ *
+ *     name?  room?                       prompts
+ *     state word=-e--e guesses=3 letters=eq
+ *     joined=alice  left=alice  turn=alice  timeout=alice
+ *     reveal letter=e at=1,4 guesses=3 player=alice
+ *     miss letter=q guesses=2 player=alice
+ *     won player=alice  lost  new
+ *     error=not_your_turn|invalid|repeated|room_unavailable
+ *     matching  matched=room             waiting for, and given, a game
+ *
+ * Positions in at count from 0.
+ */
+enum client_proto {
+    PROTO_TEXT,
+    PROTO_DELTA
+};
+
+#define DELTA_HELLO "/delta"
+#define DELTA_NAME_MSG "name?\r\n"
+#define DELTA_ROOM_MSG "room?\r\n"
+
+/* Typed at the room prompt, optionally followed by a room name, to watch
+ * that room's game instead of playing in it.
+ */
+#define WATCH_CMD "/watch"
+
+/* Typed at the room prompt, optionally followed by a word length, to be
+ * put in a new room with other players instead of naming one (see match.h).
+ */
+#define MATCH_CMD "/match"
+
+// Which list a client is on
+enum client_state {
+    CLIENT_NEW,            // still entering a name (on new_players)
+    CLIENT_CHOOSING_ROOM,  // named, choosing a room (on new_players)
+    CLIENT_MATCHING,       // named, waiting to be matched (on new_players)
+    CLIENT_PLAYING,        // in a room's turn order (on room->game.head)
+    CLIENT_WATCHING        // a spectator (on room->spectators)
+};
+
 struct client {
     int fd;
     struct in_addr ipaddr;
     struct client *next;
+    struct client *prev;
+    enum client_state state;
+    struct room *room;    // The room the client plays in or watches, once it has joined
     char name[MAX_NAME];
-    char inbuf[MAX_BUF];  // Used to hold input from the client
-    char *in_ptr;         // A pointer into inbuf to help with partial reads
-};
+    enum client_proto proto;  // Text or delta lines (see above)
+    struct linebuf in;    // Input from the client, split into lines
 
-// Information about the dictionary used to pick random word
-struct dictionary {
-    FILE *fp;
-    int size;
-};
+    struct outq out;      // Output not yet written to the socket
+    int want_write;       // The event loop is watching for writability
+    int closing;          // Disconnect once the current batch is handled
+    int dirty;            // On the worker's list of clients to flush
+    struct client *dirty_next;
+    struct client *dirty_prev;
+    struct timer idle_timer;      // Drops it if it never joins a room
+    struct timer write_timer;     // Drops it if its socket stops draining
+    uint64_t tokens;      // Lines it may send now, in thousandths (see line_rate)
+    uint64_t refilled;    // When tokens was last topped up, in ms
+    struct timer throttle_timer;  // Reads on once it has earned a line
+    int throttled;        // Ran out of lines since it last had line_burst
+    unsigned int warned_turn;     // The room's turns when it was last told
+                                  // it is not its turn
+    int behind;           // A spectator that missed a state while its
+                          // output was still draining
+    int word_length;      // The word length it was matched for, 0 for any
+
+    unsigned int slot;    // Where the client lives in the slab (see client.h)
+    unsigned int gen;     // Changes whenever old handles to it must go stale
+} __attribute__((aligned(64)));
 
 struct game_state {
-    char word[MAX_WORD];      // The word to guess
-    char guess[MAX_WORD];     // The current guess (for example '-o-d')
-    int letters_guessed[NUM_LETTERS]; // Index i will be 1 if the corresponding
-                                      // letter has been guessed; 0 otherwise
-    int guesses_left;         // Number of guesses remaining
-    struct dictionary dict;
+    struct game board;        // The rules' view of the game (see engine.h)
+    struct msg *status;       // The rendered status_message, shared by every
+                              // broadcast of it until the game changes
+    struct msg *delta;        // The same for the delta protocol's state line
     
     struct client *head;
     struct client *has_next_turn;
 };
 
 
-void init_game(struct game_state *game, char *dict_name);
-int get_file_length(char *filename);
-char *status_message(char *msg, struct game_state *game);
\ No newline at end of file
+void init_game(struct game_state *game, struct dictionary *dict, int word_length);
+struct msg *status_banner(struct game_state *game);
+struct msg *delta_state(struct game_state *game);
+/* Render the delta line for a guess by player into buf (MAX_MSG bytes). */
+char *delta_guess(char *buf, const struct game *g, const struct guess_outcome *out,
+                  const char *player);
+void game_changed(struct game_state *game);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "iplimit.h"
+#include "log.h"
+
+struct ip_entry {
+    struct in_addr addr;
+    int count;                    // connections it holds now
+    struct ip_entry *next;
+};
+
+static struct ip_entry *addrs[IP_BUCKETS];
+static pthread_mutex_t locks[IP_LOCKS];
+static int max_per_ip;
+
+static unsigned int ip_hash(struct in_addr addr) {
+    uint32_t h = addr.s_addr * 2654435761u;
+    return (h >> 16) % IP_BUCKETS;
+}
+
+int ip_limit_init(int max) {
+    max_per_ip = max;
+    memset(addrs, 0, sizeof(addrs));
+    for (int i = 0; i < IP_LOCKS; i++) {
+        pthread_mutex_init(&locks[i], NULL);
+    }
+    return 0;
+}
+
+/* Find addr in bucket b. The bucket's lock must be held. */
+static struct ip_entry **find(unsigned int b, struct in_addr addr) {
+    struct ip_entry **p = &addrs[b];
+    while (*p != NULL && (*p)->addr.s_addr != addr.s_addr) {
+        p = &(*p)->next;
+    }
+    return p;
+}
+
+int ip_limit_claim(struct in_addr addr) {
+    if (max_per_ip == 0) {
+        return 0;
+    }
+    unsigned int b = ip_hash(addr);
+    int res = 0;
+    pthread_mutex_lock(&locks[b % IP_LOCKS]);
+    struct ip_entry **p = find(b, addr);
+    if (*p == NULL) {
+        struct ip_entry *e = malloc(sizeof(struct ip_entry));
+        if (e == NULL) {
+            log_error("ip_limit_claim", LF_ADDR("addr", addr), LF_ERRNO(errno));
+            pthread_mutex_unlock(&locks[b % IP_LOCKS]);
+            return -1;
+        }
+        e->addr = addr;
+        e->count = 1;
+        e->next = addrs[b];
+        addrs[b] = e;
+    } else if ((*p)->count >= max_per_ip) {
+        res = -1;
+    } else {
+        (*p)->count++;
+    }
+    pthread_mutex_unlock(&locks[b % IP_LOCKS]);
+    return res;
+}
+
+void ip_limit_release(struct in_addr addr) {
+    if (max_per_ip == 0) {
+        return;
+    }
+    unsigned int b = ip_hash(addr);
+    pthread_mutex_lock(&locks[b % IP_LOCKS]);
+    struct ip_entry **p = find(b, addr);
+    if (*p != NULL && --(*p)->count == 0) {
+        struct ip_entry *e = *p;
+        *p = e->next;
+        free(e);
+    }
+    pthread_mutex_unlock(&locks[b % IP_LOCKS]);
+}
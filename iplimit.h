@@ -0,0 +1,24 @@
+#ifndef _IPLIMIT_H_
+#define _IPLIMIT_H_
+
+#include <netinet/in.h>
+
+/* How many connections each address holds, across all workers, so no
+ * address can hold more than a set number at once. The table is shared by
+ * all workers and only used when clients connect or disconnect; an address
+ * is forgotten with its last connection.
+ */
+
+#define IP_BUCKETS 4096           // hash buckets in the table
+#define IP_LOCKS 64               // each lock guards every IP_LOCKS-th bucket
+
+/* Allow each address max connections, or any number if max is 0. */
+int ip_limit_init(int max);
+/* Count a new connection from addr. Returns -1, counting nothing, if addr
+ * already holds as many as it may or we are out of memory.
+ */
+int ip_limit_claim(struct in_addr addr);
+/* Forget one connection from addr counted with ip_limit_claim. */
+void ip_limit_release(struct in_addr addr);
+
+#endif
@@ -0,0 +1,98 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "linebuf.h"
+
+#define MASK (LINEBUF_SIZE - 1)
+
+void linebuf_init(struct linebuf *lb) {
+    lb->head = 0;
+    lb->tail = 0;
+    lb->scan = 0;
+    lb->truncating = 0;
+}
+
+int linebuf_fill(struct linebuf *lb, int fd) {
+    unsigned int used = lb->tail - lb->head;
+    unsigned int space = LINEBUF_SIZE - used;
+    if (space == 0) {
+        // Can't happen while callers take every line: a full buffer always
+        // holds a newline or an overlong line.
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    // The free space may wrap around the end of the ring.
+    struct iovec iov[2];
+    unsigned int start = lb->tail & MASK;
+    unsigned int first = LINEBUF_SIZE - start;
+    if (first > space) {
+        first = space;
+    }
+    iov[0].iov_base = lb->data + start;
+    iov[0].iov_len = first;
+    iov[1].iov_base = lb->data;
+    iov[1].iov_len = space - first;
+
+    struct msghdr mh = { 0 };
+    mh.msg_iov = iov;
+    mh.msg_iovlen = (space > first) ? 2 : 1;
+    int n = recvmsg(fd, &mh, MSG_DONTWAIT);
+    if (n > 0) {
+        lb->tail += n;
+    }
+    return n;
+}
+
+/* Copy len bytes starting at count from into out. */
+static void copy_out(struct linebuf *lb, char *out, unsigned int from,
+                     unsigned int len) {
+    for (unsigned int i = 0; i < len; i++) {
+        out[i] = lb->data[(from + i) & MASK];
+    }
+}
+
+int linebuf_line(struct linebuf *lb, char *line, size_t size) {
+    while (1) {
+        unsigned int nl = lb->scan;
+        while (nl != lb->tail && lb->data[nl & MASK] != '\n') {
+            nl++;
+        }
+
+        if (nl == lb->tail) {
+            // No complete line yet.
+            lb->scan = nl;
+            if (lb->truncating) {
+                lb->head = lb->tail;
+                return -1;
+            }
+            if (lb->tail - lb->head < MAX_LINE) {
+                return -1;
+            }
+            // Overlong: hand back what we have and drop the rest of it.
+            nl = lb->head + MAX_LINE;
+            lb->truncating = 1;
+        } else if (lb->truncating) {
+            // End of an overlong line that was already returned.
+            lb->head = nl + 1;
+            lb->scan = lb->head;
+            lb->truncating = 0;
+            continue;
+        }
+
+        unsigned int len = nl - lb->head;
+        unsigned int next = lb->truncating ? nl : nl + 1;
+        if (!lb->truncating && len > 0 && lb->data[(nl - 1) & MASK] == '\r') {
+            len--;
+        }
+        if (len > size - 1) {
+            len = size - 1;
+        }
+        copy_out(lb, line, lb->head, len);
+        line[len] = '\0';
+        lb->head = next;
+        lb->scan = next;
+        return len;
+    }
+}
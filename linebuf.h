@@ -0,0 +1,33 @@
+#ifndef _LINEBUF_H_
+#define _LINEBUF_H_
+
+#include <stddef.h>
+
+#define LINEBUF_SIZE 512      // bytes buffered per connection (a power of 2)
+#define MAX_LINE 256          // longer lines are cut here; the rest is dropped
+
+/* Splits the byte stream from one connection into lines. Bytes are kept
+ * in a ring, so reading never overruns and several lines that arrive in
+ * one segment are all returned, one per call to linebuf_line.
+ */
+struct linebuf {
+    char data[LINEBUF_SIZE];
+    unsigned int head;        // count of bytes consumed so far
+    unsigned int tail;        // count of bytes stored so far
+    unsigned int scan;        // no '\n' among the bytes before this count
+    int truncating;           // dropping the rest of an overlong line
+};
+
+void linebuf_init(struct linebuf *lb);
+/* Read whatever fits from fd. Returns the number of bytes read, 0 at end
+ * of file, or -1 on error (including EAGAIN; errno is set).
+ */
+int linebuf_fill(struct linebuf *lb, int fd);
+/* Copy the next complete line, without its "\n" or "\r\n", into line,
+ * truncated to size - 1 characters and '\0' terminated. A line of more
+ * than MAX_LINE characters is returned cut at MAX_LINE and the rest of it
+ * is discarded. Returns the length copied, or -1 if no line is complete.
+ */
+int linebuf_line(struct linebuf *lb, char *line, size_t size);
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "log.h"
+
+#define FLUSH_BUF (64 * 1024)     // text written out at once
+#define IDLE_SLEEP_NS 10000000    // how long the flusher naps when idle
+
+enum log_level log_min_level = LL_INFO;
+
+/* One queued record. Strings are copied into text so the caller can reuse
+ * its buffers at once; everything else is formatted by the flusher.
+ */
+struct log_record {
+    unsigned int seq;             // see log_write
+    enum log_level level;
+    int worker;
+    const char *event;
+    struct timespec ts;
+    int n;
+    struct {
+        const char *key;
+        enum log_type type;
+        long i;
+        struct in_addr addr;
+        unsigned char off;        // where a string field is in text
+    } f[LOG_FIELDS];
+    char text[LOG_TEXT];
+};
+
+/* A bounded multi-producer queue: every slot carries a sequence number that
+ * tells producers whether it is free for position pos (seq == pos) and the
+ * flusher whether it holds the record for pos (seq == pos + 1). Producers
+ * claim a position with one compare-and-swap and never wait for each other.
+ */
+static struct log_record ring[LOG_RING];
+static unsigned int head;         // next position to claim, shared
+static unsigned int tail;         // next position to print, flusher only
+static unsigned long dropped;
+
+static __thread int log_worker = -1;
+
+static const char *level_names[] = { "debug", "info", "warn", "error" };
+
+void log_set_worker(int id) {
+    log_worker = id;
+}
+
+void log_write(enum log_level level, const char *event,
+               const struct log_field *fields, int n) {
+    unsigned int pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    struct log_record *rec;
+    while (1) {
+        rec = &ring[pos & (LOG_RING - 1)];
+        int diff = (int)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The flusher is a whole ring behind: drop rather than wait.
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->level = level;
+    rec->worker = log_worker;
+    rec->event = event;
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    if (n > LOG_FIELDS) {
+        n = LOG_FIELDS;
+    }
+    rec->n = n;
+    size_t used = 0;
+    for (int i = 0; i < n; i++) {
+        rec->f[i].key = fields[i].key;
+        rec->f[i].type = fields[i].type;
+        if (fields[i].type == LT_STR) {
+            // Copy as much as fits; once text is full, strings come out empty.
+            if (used == LOG_TEXT) {
+                used = LOG_TEXT - 1;
+            }
+            size_t len = strnlen(fields[i].v.s, LOG_TEXT - used - 1);
+            memcpy(rec->text + used, fields[i].v.s, len);
+            rec->text[used + len] = '\0';
+            rec->f[i].off = used;
+            used += len + 1;
+        } else if (fields[i].type == LT_ADDR) {
+            rec->f[i].addr = fields[i].v.addr;
+        } else {
+            rec->f[i].i = fields[i].v.i;
+        }
+    }
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Append s to out, quoted if it would not read back as one value. */
+static size_t put_value(char *out, size_t room, const char *s) {
+    int quote = (*s == '\0' || strpbrk(s, " \"=\\") != NULL);
+    size_t len = 0;
+    if (quote && len < room) {
+        out[len++] = '"';
+    }
+    for (; *s != '\0' && len + 2 < room; s++) {
+        if (*s == '"' || *s == '\\') {
+            out[len++] = '\\';
+        }
+        // Names come from clients; keep their control characters out.
+        out[len++] = ((unsigned char)*s < ' ') ? '?' : *s;
+    }
+    if (quote && len < room) {
+        out[len++] = '"';
+    }
+    return len;
+}
+
+/* Append to the line at out, which has len bytes of room used; a line
+ * that does not fit is cut short. Returns the new length.
+ */
+static size_t append(char *out, size_t len, size_t room, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    len += vsnprintf(out + len, room - len, fmt, ap);
+    va_end(ap);
+    return len < room ? len : room - 1;
+}
+
+/* Render rec as one line at out. Returns its length. */
+static size_t format_record(char *out, size_t room, struct log_record *rec) {
+    struct tm tm;
+    gmtime_r(&rec->ts.tv_sec, &tm);
+    size_t len = strftime(out, room, "ts=%Y-%m-%dT%H:%M:%S", &tm);
+    len = append(out, len, room, ".%06ldZ level=%s",
+                 rec->ts.tv_nsec / 1000, level_names[rec->level]);
+    if (rec->worker >= 0) {
+        len = append(out, len, room, " worker=%d", rec->worker);
+    }
+    len = append(out, len, room, " event=%s", rec->event);
+
+    for (int i = 0; i < rec->n; i++) {
+        char buf[INET_ADDRSTRLEN + 64];
+        const char *value = buf;
+        switch (rec->f[i].type) {
+            case LT_INT:
+                snprintf(buf, sizeof(buf), "%ld", rec->f[i].i);
+                break;
+            case LT_CHAR:
+                snprintf(buf, sizeof(buf), "%c", (char)rec->f[i].i);
+                break;
+            case LT_STR:
+                value = rec->text + rec->f[i].off;
+                break;
+            case LT_ADDR:
+                inet_ntop(AF_INET, &rec->f[i].addr, buf, sizeof(buf));
+                break;
+            case LT_ERRNO:
+                // Only the flusher asks, so the shared buffer is safe.
+                value = strerror(rec->f[i].i);
+                break;
+        }
+        len = append(out, len, room, " %s=", rec->f[i].key);
+        len += put_value(out + len, room - len - 1, value);
+    }
+    out[len++] = '\n';
+    return len;
+}
+
+/* Write out everything in buf, however long the reader takes. */
+static void write_out(char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static void *flusher(void *arg) {
+    static char buf[FLUSH_BUF];
+    size_t len = 0;
+    unsigned long reported = 0;
+
+    while (1) {
+        struct log_record *rec = &ring[tail & (LOG_RING - 1)];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == tail + 1) {
+            len += format_record(buf + len, sizeof(buf) - len, rec);
+            __atomic_store_n(&rec->seq, tail + LOG_RING, __ATOMIC_RELEASE);
+            tail++;
+            if (sizeof(buf) - len < 1024) {
+                write_out(buf, len);
+                len = 0;
+            }
+            continue;
+        }
+
+        // Nothing left to print: say what was lost, write out, and nap.
+        unsigned long lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+        if (lost != reported) {
+            len += snprintf(buf + len, sizeof(buf) - len,
+                            "level=warn event=log_dropped records=%lu\n",
+                            lost - reported);
+            reported = lost;
+        }
+        if (len > 0) {
+            write_out(buf, len);
+            len = 0;
+        }
+        struct timespec nap = { 0, IDLE_SLEEP_NS };
+        nanosleep(&nap, NULL);
+    }
+    return NULL;
+}
+
+int log_init(void) {
+    char *level = getenv("WORDSRV_LOG_LEVEL");
+    if (level != NULL) {
+        for (int i = LL_DEBUG; i <= LL_ERROR; i++) {
+            if (strcasecmp(level, level_names[i]) == 0) {
+                log_min_level = i;
+            }
+        }
+    }
+    for (unsigned int i = 0; i < LOG_RING; i++) {
+        ring[i].seq = i;
+    }
+
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, flusher, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
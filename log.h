@@ -0,0 +1,81 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* Logging that never makes the event loop wait. A record is a level, an
+ * event name and a few typed fields; the caller copies them into a slot of
+ * a lock-free ring and goes on, and a background thread turns the records
+ * into text and writes them out. When the ring is full (because whatever
+ * reads our output has stopped) records are dropped and counted instead.
+ *
+ *     log_info("client_added", LF_ADDR("addr", addr), LF_INT("fd", fd));
+ *
+ * prints
+ *
+ *     ts=2026-10-16T12:00:00.123456Z level=info worker=0 event=client_added addr=127.0.0.1 fd=9
+ */
+
+enum log_level {
+    LL_DEBUG,
+    LL_INFO,
+    LL_WARN,
+    LL_ERROR
+};
+
+#define LOG_FIELDS 4          // fields in one record
+#define LOG_TEXT 96           // bytes of string fields in one record
+#define LOG_RING 4096         // records in the ring, a power of two
+
+enum log_type {
+    LT_INT,
+    LT_STR,                   // copied into the record
+    LT_CHAR,
+    LT_ADDR,                  // an IPv4 address, formatted by the flusher
+    LT_ERRNO                  // an errno value, formatted by the flusher
+};
+
+struct log_field {
+    const char *key;          // must be a string literal
+    enum log_type type;
+    union {
+        long i;
+        const char *s;
+        struct in_addr addr;
+    } v;
+};
+
+#define LF_INT(k, x)   ((struct log_field){ .key = (k), .type = LT_INT, .v.i = (x) })
+#define LF_STR(k, x)   ((struct log_field){ .key = (k), .type = LT_STR, .v.s = (x) })
+#define LF_CHAR(k, x)  ((struct log_field){ .key = (k), .type = LT_CHAR, .v.i = (x) })
+#define LF_ADDR(k, x)  ((struct log_field){ .key = (k), .type = LT_ADDR, .v.addr = (x) })
+#define LF_ERRNO(x)    ((struct log_field){ .key = "error", .type = LT_ERRNO, .v.i = (x) })
+
+/* Records below this level are not even copied. Set by WORDSRV_LOG_LEVEL. */
+extern enum log_level log_min_level;
+
+#define log_at(level, event, ...) do { \
+        if ((level) >= log_min_level) { \
+            struct log_field fields_[] = { __VA_ARGS__ }; \
+            log_write((level), (event), fields_, \
+                      sizeof(fields_) / sizeof(fields_[0])); \
+        } \
+    } while (0)
+
+#define log_debug(event, ...) log_at(LL_DEBUG, event, __VA_ARGS__)
+#define log_info(event, ...)  log_at(LL_INFO, event, __VA_ARGS__)
+#define log_warn(event, ...)  log_at(LL_WARN, event, __VA_ARGS__)
+#define log_error(event, ...) log_at(LL_ERROR, event, __VA_ARGS__)
+
+/* Read the level from the environment and start the flusher thread.
+ * Returns -1 if the thread could not be started.
+ */
+int log_init(void);
+/* Tag the records of the calling thread with worker id. */
+void log_set_worker(int id);
+/* Queue a record; event must be a string literal. Never blocks. */
+void log_write(enum log_level level, const char *event,
+               const struct log_field *fields, int n);
+
+#endif
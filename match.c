@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "match.h"
+#include "log.h"
+
+/* The players waiting for one word length, oldest first. */
+struct match_queue {
+    struct match_entry *head;
+    struct match_entry *tail;
+    int count;
+};
+
+static struct match_queue queues[MAX_WORD];  // words are shorter than MAX_WORD
+static pthread_mutex_t match_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int match_init(void) {
+    memset(queues, 0, sizeof(queues));
+    return 0;
+}
+
+int match_enqueue(client_handle client, int worker, int word_length) {
+    struct match_entry *e = malloc(sizeof(struct match_entry));
+    if (e == NULL) {
+        log_error("match_enqueue", LF_INT("length", word_length), LF_ERRNO(errno));
+        return -1;
+    }
+    e->client = client;
+    e->worker = worker;
+    e->since = timer_now_ms();
+    e->next = NULL;
+
+    struct match_queue *q = &queues[word_length];
+    pthread_mutex_lock(&match_lock);
+    e->prev = q->tail;
+    if (q->tail != NULL) {
+        q->tail->next = e;
+    } else {
+        q->head = e;
+    }
+    q->tail = e;
+    q->count++;
+    pthread_mutex_unlock(&match_lock);
+    return 0;
+}
+
+/* Unlink e from q. match_lock must be held. */
+static void unlink_entry(struct match_queue *q, struct match_entry *e) {
+    if (e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        q->head = e->next;
+    }
+    if (e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        q->tail = e->prev;
+    }
+    q->count--;
+}
+
+void match_cancel(client_handle client, int word_length) {
+    struct match_queue *q = &queues[word_length];
+    pthread_mutex_lock(&match_lock);
+    struct match_entry *e = q->head;
+    while (e != NULL && e->client != client) {
+        e = e->next;
+    }
+    if (e != NULL) {
+        unlink_entry(q, e);
+    }
+    pthread_mutex_unlock(&match_lock);
+    free(e);
+}
+
+struct match_entry *match_take(int word_length, int room_size, uint64_t waited_since,
+                               int *n) {
+    struct match_queue *q = &queues[word_length];
+    struct match_entry *taken = NULL;
+    *n = 0;
+    // Nothing to do, as nearly always: don't take the lock to find out.
+    if (__atomic_load_n(&q->count, __ATOMIC_RELAXED) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&match_lock);
+    if (q->count >= room_size || (q->head != NULL && q->head->since < waited_since)) {
+        taken = q->head;
+        while (q->head != NULL && *n < room_size) {
+            unlink_entry(q, q->head);
+            (*n)++;
+        }
+        // The last one taken still points at the first one left.
+        struct match_entry *e = taken;
+        for (int i = 1; i < *n; i++) {
+            e = e->next;
+        }
+        e->next = NULL;
+    }
+    pthread_mutex_unlock(&match_lock);
+    return taken;
+}
@@ -0,0 +1,40 @@
+#ifndef _MATCH_H_
+#define _MATCH_H_
+
+#include <stdint.h>
+
+#include "client.h"
+
+/* Matchmaking: named players who would rather be put in a game than name
+ * a room wait in a queue, one per preferred word length (0 for any), until
+ * there are enough of them to fill a room, or the first of them has waited
+ * long enough. They are then taken off together and sent to a new room.
+ * The queues are shared by all workers; a player stays on its own worker
+ * while it waits.
+ */
+
+/* A player waiting for a game. */
+struct match_entry {
+    client_handle client;
+    int worker;                   // the worker the client is on
+    uint64_t since;               // when it started waiting (timer_now_ms)
+    struct match_entry *next;
+    struct match_entry *prev;
+};
+
+int match_init(void);
+/* Queue client of worker for a game with words of length word_length.
+ * Returns -1 if out of memory.
+ */
+int match_enqueue(client_handle client, int worker, int word_length);
+/* Take client, which has gone, off the queue for word_length. */
+void match_cancel(client_handle client, int word_length);
+/* If room_size players wait for word_length, or the first of them started
+ * waiting before waited_since, take up to room_size of them off the queue
+ * and return them, first come first; the caller frees them. Otherwise
+ * return NULL. *n is set to how many were taken.
+ */
+struct match_entry *match_take(int word_length, int room_size, uint64_t waited_since,
+                               int *n);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+static const char *counter_names[NUM_COUNTERS] = {
+    "wordsrv_connections_accepted_total",
+    "wordsrv_connections_closed_total",
+    "wordsrv_connections_rejected_total",
+    "wordsrv_games_started_total",
+    "wordsrv_games_finished_total",
+    "wordsrv_guesses_total",
+    "wordsrv_bytes_in_total",
+    "wordsrv_bytes_out_total",
+    "wordsrv_write_failures_total",
+    "wordsrv_slow_clients_total",
+    "wordsrv_throttled_total",
+    "wordsrv_timeouts_total",
+    "wordsrv_loop_iterations_total"
+};
+
+static const char *histogram_names[NUM_HISTOGRAMS] = {
+    "wordsrv_loop_time_us",
+    "wordsrv_handler_time_us"
+};
+
+void metrics_observe(struct metrics *m, enum histogram h, uint64_t usec) {
+    int b = 0;
+    while (b < HIST_BUCKETS && usec > (1ULL << b)) {
+        b++;
+    }
+    __atomic_store_n(&m->buckets[h][b], m->buckets[h][b] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&m->sum[h], m->sum[h] + usec, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t load(const uint64_t *v) {
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+/* Append to buf at *len without overrunning size. */
+static void append(char *buf, size_t size, size_t *len, const char *fmt, ...) {
+    if (*len >= size - 1) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    if (n > 0) {
+        *len += n;
+        if (*len > size - 1) {
+            *len = size - 1;
+        }
+    }
+}
+
+size_t metrics_format(char *buf, size_t size, struct metrics **shards, int n,
+                      double uptime) {
+    size_t len = 0;
+    uint64_t totals[NUM_COUNTERS] = { 0 };
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            totals[c] += load(&shards[i]->counters[c]);
+        }
+    }
+
+    append(buf, size, &len, "# TYPE wordsrv_uptime_seconds gauge\n"
+           "wordsrv_uptime_seconds %.3f\n", uptime);
+    append(buf, size, &len, "# TYPE wordsrv_workers gauge\nwordsrv_workers %d\n", n);
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        append(buf, size, &len, "# TYPE %s counter\n%s %llu\n", counter_names[c],
+               counter_names[c], (unsigned long long)totals[c]);
+    }
+    append(buf, size, &len, "# TYPE wordsrv_connections_active gauge\n"
+           "wordsrv_connections_active %llu\n",
+           (unsigned long long)(totals[M_CONN_ACCEPTED] - totals[M_CONN_CLOSED]));
+    if (uptime > 0) {
+        append(buf, size, &len, "# TYPE wordsrv_guesses_per_second gauge\n"
+               "wordsrv_guesses_per_second %.1f\n", totals[M_GUESSES] / uptime);
+    }
+
+    for (int h = 0; h < NUM_HISTOGRAMS; h++) {
+        const char *name = histogram_names[h];
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        append(buf, size, &len, "# TYPE %s histogram\n", name);
+        for (int b = 0; b <= HIST_BUCKETS; b++) {
+            for (int i = 0; i < n; i++) {
+                count += load(&shards[i]->buckets[h][b]);
+            }
+            if (b < HIST_BUCKETS) {
+                append(buf, size, &len, "%s_bucket{le=\"%llu\"} %llu\n", name,
+                       1ULL << b, (unsigned long long)count);
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            sum += load(&shards[i]->sum[h]);
+        }
+        append(buf, size, &len, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %llu\n"
+               "%s_count %llu\n", name, (unsigned long long)count, name,
+               (unsigned long long)sum, name, (unsigned long long)count);
+    }
+    return len;
+}
@@ -0,0 +1,58 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Counters kept by every worker. */
+enum counter {
+    M_CONN_ACCEPTED,
+    M_CONN_CLOSED,
+    M_CONN_REJECTED,          // accepted and closed at once, out of descriptors
+                              // or over the limit for the address
+    M_GAMES_STARTED,
+    M_GAMES_FINISHED,
+    M_GUESSES,
+    M_BYTES_IN,
+    M_BYTES_OUT,
+    M_WRITE_FAILURES,
+    M_SLOW_CLIENTS,           // disconnected for not reading their output
+    M_THROTTLED,              // times a client started sending faster than line_rate
+    M_TIMEOUTS,               // turns passed on and clients dropped by a timer
+    M_LOOP_ITERATIONS,
+    NUM_COUNTERS
+};
+
+/* Latency histograms kept by every worker. */
+enum histogram {
+    H_LOOP_TIME,              // one event loop iteration, excluding the wait
+    H_HANDLER_TIME,           // handling the input of one ready descriptor
+    NUM_HISTOGRAMS
+};
+
+#define HIST_BUCKETS 24       // bucket i counts durations of at most 2^i us
+
+/* One worker's metrics. Only the owning worker writes them, so updates are
+ * plain relaxed stores; the admin thread reads every worker's copy and adds
+ * them up when it reports.
+ */
+struct metrics {
+    uint64_t counters[NUM_COUNTERS];
+    uint64_t buckets[NUM_HISTOGRAMS][HIST_BUCKETS + 1];   // last is overflow
+    uint64_t sum[NUM_HISTOGRAMS];
+} __attribute__((aligned(64)));
+
+static inline void metrics_add(struct metrics *m, enum counter c, uint64_t n) {
+    __atomic_store_n(&m->counters[c], m->counters[c] + n, __ATOMIC_RELAXED);
+}
+
+void metrics_observe(struct metrics *m, enum histogram h, uint64_t usec);
+/* Return the time in microseconds on a monotonic clock. */
+uint64_t metrics_now(void);
+/* Write the sum of n workers' metrics into buf in the plain text scrape
+ * format. Returns the length written (truncated to size - 1).
+ */
+size_t metrics_format(char *buf, size_t size, struct metrics **shards, int n,
+                      double uptime);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "names.h"
+#include "gameplay.h"
+#include "log.h"
+
+/* A name in the table: held by a client, or reserved until some time. */
+struct name_entry {
+    char name[MAX_NAME];
+    uint64_t reserved_until;      // 0 while a client holds the name
+    char room[MAX_NAME];          // where a reserved name's player goes
+    struct name_entry *next;
+};
+
+static struct name_entry *names[NAME_BUCKETS];
+static pthread_mutex_t locks[NAME_LOCKS];
+
+/* FNV-1a hash of a name with its letters folded to lowercase. */
+static unsigned int name_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)tolower((unsigned char)*name)) * 16777619u;
+    }
+    return h % NAME_BUCKETS;
+}
+
+int name_registry_init(void) {
+    memset(names, 0, sizeof(names));
+    for (int i = 0; i < NAME_LOCKS; i++) {
+        pthread_mutex_init(&locks[i], NULL);
+    }
+    return 0;
+}
+
+/* Find name in bucket b, letting go of reservations that ran out on the
+ * way. The bucket's lock must be held.
+ */
+static struct name_entry **find(unsigned int b, const char *name, uint64_t now) {
+    struct name_entry **p = &names[b];
+    while (*p != NULL) {
+        struct name_entry *e = *p;
+        if (e->reserved_until != 0 && e->reserved_until < now) {
+            *p = e->next;
+            free(e);
+            continue;
+        }
+        if (strcasecmp(e->name, name) == 0) {
+            break;
+        }
+        p = &e->next;
+    }
+    return p;
+}
+
+int name_registry_claim(const char *name, char *room) {
+    unsigned int b = name_hash(name);
+    uint64_t now = timer_now_ms();
+    int res = 0;
+    pthread_mutex_lock(&locks[b % NAME_LOCKS]);
+    struct name_entry **p = find(b, name, now);
+    if (*p == NULL) {
+        struct name_entry *e = malloc(sizeof(struct name_entry));
+        if (e == NULL) {
+            log_error("name_claim", LF_STR("name", name), LF_ERRNO(errno));
+            pthread_mutex_unlock(&locks[b % NAME_LOCKS]);
+            return -1;
+        }
+        strncpy(e->name, name, MAX_NAME);
+        e->name[MAX_NAME - 1] = '\0';
+        e->reserved_until = 0;
+        e->next = names[b];
+        names[b] = e;
+    } else if ((*p)->reserved_until == 0) {
+        res = -1;
+    } else {
+        // The player a reservation was for is back.
+        memcpy(room, (*p)->room, MAX_NAME);
+        (*p)->reserved_until = 0;
+        res = 1;
+    }
+    pthread_mutex_unlock(&locks[b % NAME_LOCKS]);
+    return res;
+}
+
+void name_registry_release(const char *name) {
+    unsigned int b = name_hash(name);
+    pthread_mutex_lock(&locks[b % NAME_LOCKS]);
+    struct name_entry **p = find(b, name, timer_now_ms());
+    if (*p != NULL && (*p)->reserved_until == 0) {
+        struct name_entry *e = *p;
+        *p = e->next;
+        free(e);
+    }
+    pthread_mutex_unlock(&locks[b % NAME_LOCKS]);
+}
+
+void name_registry_reserve(const char *name, const char *room, uint64_t until) {
+    unsigned int b = name_hash(name);
+    pthread_mutex_lock(&locks[b % NAME_LOCKS]);
+    struct name_entry **p = find(b, name, timer_now_ms());
+    struct name_entry *e = *p;
+    if (e == NULL) {
+        e = malloc(sizeof(struct name_entry));
+        if (e == NULL) {
+            log_error("name_reserve", LF_STR("name", name), LF_ERRNO(errno));
+            pthread_mutex_unlock(&locks[b % NAME_LOCKS]);
+            return;
+        }
+        strncpy(e->name, name, MAX_NAME);
+        e->name[MAX_NAME - 1] = '\0';
+        e->next = names[b];
+        names[b] = e;
+    } else if (e->reserved_until == 0) {
+        pthread_mutex_unlock(&locks[b % NAME_LOCKS]);
+        return;
+    }
+    strncpy(e->room, room, MAX_NAME);
+    e->room[MAX_NAME - 1] = '\0';
+    e->reserved_until = until;
+    pthread_mutex_unlock(&locks[b % NAME_LOCKS]);
+}
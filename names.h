@@ -0,0 +1,34 @@
+#ifndef _NAMES_H_
+#define _NAMES_H_
+
+#include <stdint.h>
+
+/* The names in use anywhere on the server, whichever worker the client
+ * is on and whether it has joined a room yet, so no two clients can hold
+ * the same name. Names are compared without regard to case: "Alice" and
+ * "alice" are one name. The table is shared by all workers and only used
+ * when clients give their name or leave.
+ *
+ * A name can also be reserved, for a player expected back in a room (see
+ * snapshot.h): until the reservation runs out, the first client to give
+ * the name gets it and is told the room.
+ */
+
+#define NAME_BUCKETS 4096         // hash buckets in the table
+#define NAME_LOCKS 64             // each lock guards every NAME_LOCKS-th bucket
+
+int name_registry_init(void);
+/* Give name to the client asking for it. Returns 0 if it was free, 1 if
+ * it was reserved (the room it was reserved in is copied into room,
+ * MAX_NAME bytes), or -1 if another client holds it or we are out of
+ * memory.
+ */
+int name_registry_claim(const char *name, char *room);
+/* Let go of a name claimed with name_registry_claim. */
+void name_registry_release(const char *name);
+/* Reserve name for a player of room until time until (see timer_now_ms).
+ * A name someone holds is left alone.
+ */
+void name_registry_reserve(const char *name, const char *room, uint64_t until);
+
+#endif
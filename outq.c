@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "outq.h"
+
+#define OUTQ_MIN_CAP 8
+
+struct msg *msg_new(const char *data, size_t len) {
+    struct msg *m = malloc(sizeof(struct msg) + len);
+    if (m == NULL) {
+        return NULL;
+    }
+    m->refs = 1;
+    m->len = len;
+    memcpy(m->data, data, len);
+    return m;
+}
+
+/* Clients can be handed to another worker with messages still queued, so
+ * the count is updated atomically.
+ */
+struct msg *msg_hold(struct msg *m) {
+    __atomic_add_fetch(&m->refs, 1, __ATOMIC_RELAXED);
+    return m;
+}
+
+void msg_release(struct msg *m) {
+    if (m != NULL && __atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(m);
+    }
+}
+
+void outq_init(struct outq *q) {
+    q->ring = NULL;
+    q->first = 0;
+    q->count = 0;
+    q->cap = 0;
+    q->off = 0;
+    q->bytes = 0;
+}
+
+int outq_push(struct outq *q, struct msg *m) {
+    if (m->len == 0) {
+        return 0;
+    }
+    if (q->count == q->cap) {
+        unsigned int cap = q->cap ? q->cap * 2 : OUTQ_MIN_CAP;
+        struct msg **ring = malloc(cap * sizeof(struct msg *));
+        if (ring == NULL) {
+            return -1;
+        }
+        // Unwrap the old ring into the front of the new one.
+        for (unsigned int i = 0; i < q->count; i++) {
+            ring[i] = q->ring[(q->first + i) & (q->cap - 1)];
+        }
+        free(q->ring);
+        q->ring = ring;
+        q->first = 0;
+        q->cap = cap;
+    }
+    q->ring[(q->first + q->count) & (q->cap - 1)] = msg_hold(m);
+    q->count++;
+    q->bytes += m->len;
+    return 0;
+}
+
+/* Point iov at the first OUTQ_IOV messages still to be written. Returns
+ * how many entries were used and sets *offered to the bytes they hold.
+ */
+static unsigned int outq_iov(struct outq *q, struct iovec *iov, size_t *offered) {
+    unsigned int n = 0;
+    *offered = 0;
+    for (; n < q->count && n < OUTQ_IOV; n++) {
+        struct msg *m = q->ring[(q->first + n) & (q->cap - 1)];
+        size_t skip = (n == 0) ? q->off : 0;
+        iov[n].iov_base = m->data + skip;
+        iov[n].iov_len = m->len - skip;
+        *offered += iov[n].iov_len;
+    }
+    return n;
+}
+
+/* Drop every message that has been written completely. */
+static void outq_consume(struct outq *q, size_t written) {
+    q->bytes -= written;
+    while (written > 0) {
+        struct msg *m = q->ring[q->first];
+        size_t left = m->len - q->off;
+        if (written < left) {
+            q->off += written;
+            break;
+        }
+        written -= left;
+        q->off = 0;
+        q->first = (q->first + 1) & (q->cap - 1);
+        q->count--;
+        msg_release(m);
+    }
+}
+
+int outq_flush(struct outq *q, int fd) {
+    while (q->count > 0) {
+        struct iovec iov[OUTQ_IOV];
+        size_t offered;
+        unsigned int n = outq_iov(q, iov, &offered);
+
+        ssize_t written = writev(fd, iov, n);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+            return -1;
+        }
+
+        outq_consume(q, written);
+        if ((size_t)written < offered && q->count > 0) {
+            // The socket took only part of what we offered.
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void outq_flush_batch(struct uring *ring, struct outq_job *jobs, int n) {
+    // Each batch tags its submissions, so a completion left over from an
+    // earlier batch is never taken for one of this batch's jobs.
+    static __thread uint32_t batch_seq;
+    uint64_t tag = (uint64_t)++batch_seq << 32;
+    int in_flight = 0;
+    for (int i = 0; i < n; i++) {
+        struct outq_job *job = &jobs[i];
+        job->res = 0;
+        job->submitted = 0;
+        if (job->q == NULL || job->q->count == 0) {
+            continue;
+        }
+        struct io_uring_sqe *sqe = uring_sqe(ring);
+        if (sqe == NULL) {
+            job->res = outq_flush(job->q, job->fd);
+            job->err = errno;
+            continue;
+        }
+        memset(&job->mh, 0, sizeof(job->mh));
+        job->mh.msg_iov = job->iov;
+        job->mh.msg_iovlen = outq_iov(job->q, job->iov, &job->offered);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = job->fd;
+        sqe->addr = (uintptr_t)&job->mh;
+        sqe->len = 1;
+        // Don't wait for room in a full socket: report it, as writev would.
+        sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+        sqe->user_data = tag | i;
+        job->submitted = 1;
+        in_flight++;
+    }
+
+    while (in_flight > 0) {
+        // The sends never wait for a peer, so this returns promptly.
+        if (uring_enter(ring, in_flight, -1) == -1 && errno != EINTR) {
+            /* The kernel may have taken some sends before it failed; those
+             * complete as usual. The rest are taken back before it can
+             * run them later, and written the ordinary way.
+             */
+            int err = errno;
+            int withdrawn = 0;
+            struct io_uring_sqe *sqe;
+            while ((sqe = uring_withdraw(ring)) != NULL) {
+                if ((sqe->user_data & ~0xffffffffULL) != tag) {
+                    continue;
+                }
+                struct outq_job *job = &jobs[(uint32_t)sqe->user_data];
+                job->submitted = 0;
+                job->res = outq_flush(job->q, job->fd);
+                job->err = errno;
+                in_flight--;
+                withdrawn++;
+            }
+            if (withdrawn == 0 && uring_cqe(ring) == NULL) {
+                /* Nothing to take back and nothing completed: we can't
+                 * tell what went out of the sends still with the kernel,
+                 * so their clients are given up as failed writes.
+                 */
+                for (int i = 0; i < n; i++) {
+                    if (jobs[i].submitted) {
+                        jobs[i].submitted = 0;
+                        jobs[i].res = -1;
+                        jobs[i].err = err;
+                    }
+                }
+                return;
+            }
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_cqe(ring)) != NULL) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            uring_cqe_seen(ring);
+            if ((data & ~0xffffffffULL) != tag) {
+                continue;
+            }
+            struct outq_job *job = &jobs[(uint32_t)data];
+            job->submitted = 0;
+            in_flight--;
+
+            if (res == -EAGAIN) {
+                job->res = 1;
+            } else if (res < 0) {
+                job->res = -1;
+                job->err = -res;
+            } else {
+                outq_consume(job->q, res);
+                if ((size_t)res < job->offered && job->q->count > 0) {
+                    job->res = 1;
+                } else if (job->q->count > 0) {
+                    // More than one sendmsg worth was queued.
+                    job->res = outq_flush(job->q, job->fd);
+                    job->err = errno;
+                }
+            }
+        }
+    }
+}
+
+void outq_free(struct outq *q) {
+    for (unsigned int i = 0; i < q->count; i++) {
+        msg_release(q->ring[(q->first + i) & (q->cap - 1)]);
+    }
+    free(q->ring);
+    outq_init(q);
+}
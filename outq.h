@@ -0,0 +1,71 @@
+#ifndef _OUTQ_H_
+#define _OUTQ_H_
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "uring.h"
+
+#define OUTQ_IOV 64               // messages written by one writev
+#define OUTQ_HIGH_WATER (64 * 1024)   // default limit on queued bytes
+
+/* An immutable, reference counted message. A broadcast is formatted once
+ * into a msg and every recipient's queue holds a pointer to it; the msg is
+ * freed when the last queue has written it.
+ */
+struct msg {
+    int refs;
+    size_t len;
+    char data[];
+};
+
+/* Output waiting to be written to one non-blocking socket: a ring of
+ * messages, the first of which may be partly written.
+ */
+struct outq {
+    struct msg **ring;
+    unsigned int first;       // ring index of the oldest message
+    unsigned int count;       // messages in the ring
+    unsigned int cap;         // size of ring (a power of 2)
+    size_t off;               // bytes of the oldest message already written
+    size_t bytes;             // bytes queued and not yet written
+};
+
+/* Return a new message holding a copy of len bytes of data, with one
+ * reference owned by the caller, or NULL if out of memory.
+ */
+struct msg *msg_new(const char *data, size_t len);
+struct msg *msg_hold(struct msg *m);
+void msg_release(struct msg *m);
+
+void outq_init(struct outq *q);
+/* Queue m, taking a new reference to it. Returns -1 if out of memory. */
+int outq_push(struct outq *q, struct msg *m);
+/* Write as much of the queue as the socket takes, in one writev per
+ * OUTQ_IOV messages. Returns 0 when the queue is empty, 1 if the socket is
+ * full and data is left, or -1 on a write error (errno is set).
+ */
+int outq_flush(struct outq *q, int fd);
+void outq_free(struct outq *q);
+
+/* One queue to write in a batch, and how that went. */
+struct outq_job {
+    struct outq *q;           // NULL to skip this job
+    int fd;
+    int res;                  // set as outq_flush would return it
+    int err;                  // errno, when res is -1
+    int submitted;            // its sendmsg is with the kernel
+    struct iovec iov[OUTQ_IOV];
+    struct msghdr mh;
+    size_t offered;
+};
+
+/* Flush every job's queue as outq_flush would, but submit the first
+ * sendmsg of all of them through ring with a single system call: a turn
+ * that reaches a whole room costs one io_uring_enter instead of one
+ * writev per player.
+ */
+void outq_flush_batch(struct uring *ring, struct outq_job *jobs, int n);
+
+#endif
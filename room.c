@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "room.h"
+#include "log.h"
+
+/* FNV-1a hash of a room name. */
+static unsigned int room_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h % ROOM_BUCKETS;
+}
+
+void room_table_init(struct room_table *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+struct room *room_lookup(struct room_table *table, const char *name) {
+    struct room *r = table->buckets[room_hash(name)];
+    while (r != NULL && strcmp(r->name, name) != 0) {
+        r = r->hash_next;
+    }
+    return r;
+}
+
+struct room *room_create(struct room_table *table, const char *name,
+                         struct dictionary *dict, int word_length) {
+    struct room *r = malloc(sizeof(struct room));
+    if (r == NULL) {
+        log_error("room_create", LF_STR("room", name), LF_ERRNO(errno));
+        return NULL;
+    }
+    strncpy(r->name, name, MAX_NAME);
+    r->name[MAX_NAME - 1] = '\0';
+    r->num_players = 0;
+    r->word_length = word_length;
+    r->spectators = NULL;
+    r->num_spectators = 0;
+    r->state_changed = 0;
+    r->changed_next = NULL;
+    r->unsaved = 0;
+    r->unsaved_next = NULL;
+
+    r->game.status = NULL;
+    r->game.delta = NULL;
+    init_game(&r->game, dict, word_length);
+    r->game.head = NULL;
+    r->game.has_next_turn = NULL;
+    timer_init(&r->turn_timer, NULL);
+    r->timed_player = NULL;
+    r->turns = 0;
+    r->held_until = 0;
+
+    unsigned int b = room_hash(r->name);
+    r->hash_next = table->buckets[b];
+    table->buckets[b] = r;
+
+    r->prev = NULL;
+    r->next = table->head;
+    if (table->head != NULL) {
+        table->head->prev = r;
+    }
+    table->head = r;
+    table->count++;
+    return r;
+}
+
+/* Remove room from the table and free it. The room must have no players
+ * or spectators, and must not be on a worker's list of changed or unsaved
+ * rooms.
+ */
+void room_destroy(struct room_table *table, struct room *room) {
+    struct room **p = &table->buckets[room_hash(room->name)];
+    while (*p != NULL && *p != room) {
+        p = &(*p)->hash_next;
+    }
+    if (*p == NULL) {
+        log_error("destroy_unknown_room", LF_STR("room", room->name));
+        return;
+    }
+    *p = room->hash_next;
+
+    if (room->prev != NULL) {
+        room->prev->next = room->next;
+    } else {
+        table->head = room->next;
+    }
+    if (room->next != NULL) {
+        room->next->prev = room->prev;
+    }
+    table->count--;
+    timer_cancel(&room->turn_timer);
+    msg_release(room->game.status);
+    msg_release(room->game.delta);
+    free(room);
+}
+
+
+/* An entry in the room directory. */
+struct room_owner {
+    char name[MAX_NAME];
+    int worker;
+    struct room_owner *next;
+};
+
+static struct room_owner *directory[ROOM_BUCKETS];
+static pthread_mutex_t directory_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int room_directory_init(void) {
+    memset(directory, 0, sizeof(directory));
+    return 0;
+}
+
+int room_directory_claim(const char *name, int worker) {
+    unsigned int b = room_hash(name);
+    pthread_mutex_lock(&directory_lock);
+    struct room_owner *o = directory[b];
+    while (o != NULL && strcmp(o->name, name) != 0) {
+        o = o->next;
+    }
+    if (o == NULL) {
+        o = malloc(sizeof(struct room_owner));
+        if (o == NULL) {
+            log_error("room_directory_claim", LF_STR("room", name), LF_ERRNO(errno));
+            pthread_mutex_unlock(&directory_lock);
+            return -1;
+        }
+        strncpy(o->name, name, MAX_NAME);
+        o->name[MAX_NAME - 1] = '\0';
+        o->worker = worker;
+        o->next = directory[b];
+        directory[b] = o;
+    }
+    int owner = o->worker;
+    pthread_mutex_unlock(&directory_lock);
+    return owner;
+}
+
+void room_directory_release(const char *name, int worker) {
+    unsigned int b = room_hash(name);
+    pthread_mutex_lock(&directory_lock);
+    struct room_owner **p = &directory[b];
+    while (*p != NULL && strcmp((*p)->name, name) != 0) {
+        p = &(*p)->next;
+    }
+    if (*p != NULL && (*p)->worker == worker) {
+        struct room_owner *o = *p;
+        *p = o->next;
+        free(o);
+    }
+    pthread_mutex_unlock(&directory_lock);
+}
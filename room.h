@@ -0,0 +1,68 @@
+#ifndef _ROOM_H_
+#define _ROOM_H_
+
+#include <pthread.h>
+
+#include "gameplay.h"
+
+#define ROOM_BUCKETS 1024         // hash buckets in a room table
+#define DEFAULT_ROOM "lobby"
+#define ROOM_MSG "Which room would you like to join? (press enter for the lobby, " \
+    "or /match to play with whoever else is waiting) "
+
+/* One game being played by the players who joined it, and watched by
+ * its spectators. Spectators are not in the turn order and are only ever
+ * sent the game's latest state; see fan_out_spectators.
+ */
+struct room {
+    char name[MAX_NAME];
+    struct game_state game;
+    int num_players;
+    int word_length;              // of the words its games pick, 0 for any
+    struct client *spectators;
+    int num_spectators;
+    int state_changed;            // On the worker's list of rooms whose
+    struct room *changed_next;    // spectators have a new state to see
+    int unsaved;                  // On the worker's list of rooms changed
+    struct room *unsaved_next;    // since the last snapshot
+    struct timer turn_timer;      // Passes the turn on if nobody guesses
+    struct client *timed_player;  // Whose turn turn_timer is timing
+    unsigned int turns;           // Bumped each time the turn is announced
+    uint64_t held_until;          // Kept open until then (timer_now_ms) even
+                                  // with nobody in it, for players to come
+
+    struct room *hash_next;       // next room in the same hash bucket
+    struct room *next;            // every room, for walking the table
+    struct room *prev;
+};
+
+/* All rooms hosted by the server, found by name. */
+struct room_table {
+    struct room *buckets[ROOM_BUCKETS];
+    struct room *head;
+    int count;
+};
+
+void room_table_init(struct room_table *table);
+struct room *room_lookup(struct room_table *table, const char *name);
+/* Create a room and start its first game, with words word_length letters
+ * long (0 for any). Returns NULL if out of memory.
+ */
+struct room *room_create(struct room_table *table, const char *name,
+                         struct dictionary *dict, int word_length);
+void room_destroy(struct room_table *table, struct room *room);
+
+/* The room directory records which worker hosts each room, so a player
+ * on any worker can be sent to the one hosting the room they ask for.
+ * It is shared by all workers and only used when players join or leave
+ * rooms, never while a game is being played.
+ */
+int room_directory_init(void);
+/* Return the worker hosting name, recording worker as the host if no
+ * worker hosts it yet. Returns -1 if out of memory.
+ */
+int room_directory_claim(const char *name, int worker);
+/* Forget that worker hosts name. */
+void room_directory_release(const char *name, int worker);
+
+#endif
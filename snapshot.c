@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "names.h"
+#include "log.h"
+
+#define SNAPSHOT_BUCKETS 1024
+#define COMPACT_MIN (64 * 1024)   // never rewrite a file smaller than this
+
+/* A record on its way to the file, and afterwards the latest record of its
+ * room, kept for rewriting the file.
+ */
+struct entry {
+    struct entry *next;       // in the queue, then in its hash bucket
+    struct snapshot_room rec; // only snapshot_size(&rec) bytes are allocated
+};
+
+static char *snap_path;
+static int snap_fd = -1;
+static size_t file_size;          // bytes in the file
+static size_t live_size;          // bytes the latest records take
+static int behind;                // the file lacks records the table has
+
+// Touched only by snapshot_open and then by the writer thread.
+static struct entry *table[SNAPSHOT_BUCKETS];
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static struct entry *queue_head;
+static struct entry *queue_tail;
+
+/* FNV-1a hash of n bytes at p. */
+static uint32_t fnv1a(const void *p, size_t n) {
+    const unsigned char *c = p;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ c[i]) * 16777619u;
+    }
+    return h;
+}
+
+static unsigned int bucket_of(const char *name) {
+    return fnv1a(name, strlen(name)) % SNAPSHOT_BUCKETS;
+}
+
+/* The checksum covers everything after the checksum itself. */
+static uint32_t checksum(const struct snapshot_room *rec) {
+    size_t skip = offsetof(struct snapshot_room, kind);
+    return fnv1a((const char *)rec + skip, snapshot_size(rec) - skip);
+}
+
+/* Make e the latest record of its room, or forget the room if e says it
+ * was closed. Takes e.
+ */
+static void table_put(struct entry *e) {
+    struct entry **p = &table[bucket_of(e->rec.room)];
+    while (*p != NULL && strcmp((*p)->rec.room, e->rec.room) != 0) {
+        p = &(*p)->next;
+    }
+    if (*p != NULL) {
+        struct entry *old = *p;
+        *p = old->next;
+        live_size -= snapshot_size(&old->rec);
+        free(old);
+    }
+    if (e->rec.kind == SNAP_GONE) {
+        free(e);
+        return;
+    }
+    e->next = *p;
+    *p = e;
+    live_size += snapshot_size(&e->rec);
+}
+
+/* Write out all n bytes at buf. */
+static int write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, buf, n);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* Replace the file with one holding only the latest record of each room.
+ * It is written under a temporary name and renamed into place, so a crash
+ * leaves either the old file or the new one.
+ */
+static int compact(void) {
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", snap_path) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    char *buf = malloc(live_size > 0 ? live_size : 1);
+    if (buf == NULL) {
+        return -1;
+    }
+    size_t len = 0;
+    for (int b = 0; b < SNAPSHOT_BUCKETS; b++) {
+        for (struct entry *e = table[b]; e != NULL; e = e->next) {
+            memcpy(buf + len, &e->rec, snapshot_size(&e->rec));
+            len += snapshot_size(&e->rec);
+        }
+    }
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        free(buf);
+        return -1;
+    }
+    if (write_all(fd, buf, len) == -1 || fdatasync(fd) == -1
+            || rename(tmp, snap_path) == -1) {
+        int err = errno;
+        close(fd);
+        unlink(tmp);
+        free(buf);
+        errno = err;
+        return -1;
+    }
+    free(buf);
+    // What we write from now on goes after the records just written.
+    if (snap_fd != -1) {
+        close(snap_fd);
+    }
+    snap_fd = fd;
+    file_size = len;
+    return 0;
+}
+
+/* Read the records in the n bytes at buf into the table, stopping at the
+ * first that is not whole. Returns how many bytes were whole records.
+ */
+static size_t read_records(const char *buf, size_t n) {
+    size_t head = offsetof(struct snapshot_room, seats);
+    size_t off = 0;
+    while (n - off >= head) {
+        struct snapshot_room rec;
+        memcpy(&rec, buf + off, head);
+        if (rec.magic != SNAPSHOT_MAGIC || rec.kind > SNAP_GONE
+                || rec.num_seats > SNAPSHOT_MAX_SEATS
+                || snapshot_size(&rec) > n - off) {
+            break;
+        }
+        memcpy(&rec, buf + off, snapshot_size(&rec));
+        if (rec.checksum != checksum(&rec) || rec.room[MAX_NAME - 1] != '\0') {
+            break;
+        }
+
+        struct entry *e = malloc(offsetof(struct entry, rec) + snapshot_size(&rec));
+        if (e == NULL) {
+            perror("malloc");
+            break;
+        }
+        memcpy(&e->rec, &rec, snapshot_size(&rec));
+        table_put(e);
+        off += snapshot_size(&rec);
+    }
+    return off;
+}
+
+int snapshot_open(const char *path) {
+    snap_path = strdup(path);
+    if (snap_path == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && errno != ENOENT) {
+        perror(path);
+        return -1;
+    }
+    if (fd != -1) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            perror("fstat");
+            close(fd);
+            return -1;
+        }
+        char *buf = malloc(st.st_size > 0 ? st.st_size : 1);
+        if (buf == NULL) {
+            perror("malloc");
+            close(fd);
+            return -1;
+        }
+        size_t got = 0;
+        while (got < (size_t)st.st_size) {
+            ssize_t n = read(fd, buf + got, st.st_size - got);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                if (n == -1) {
+                    perror("read");
+                }
+                break;
+            }
+            got += n;
+        }
+        close(fd);
+
+        size_t whole = read_records(buf, got);
+        if (whole < got) {
+            fprintf(stderr, "%s: dropped %zu bytes after the last whole record\n",
+                    path, got - whole);
+        }
+        free(buf);
+    }
+
+    // Start from a file with nothing but the rooms we restore.
+    if (compact() == -1) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+void snapshot_each(void (*fn)(const struct snapshot_room *rec)) {
+    for (int b = 0; b < SNAPSHOT_BUCKETS; b++) {
+        for (struct entry *e = table[b]; e != NULL; e = e->next) {
+            fn(&e->rec);
+        }
+    }
+}
+
+void snapshot_hold_seats(uint64_t until) {
+    for (int b = 0; b < SNAPSHOT_BUCKETS; b++) {
+        for (struct entry *e = table[b]; e != NULL; e = e->next) {
+            for (uint32_t i = 0; i < e->rec.num_seats; i++) {
+                char name[MAX_NAME];
+                memcpy(name, e->rec.seats[i], MAX_NAME);
+                name[MAX_NAME - 1] = '\0';
+                name_registry_reserve(name, e->rec.room, until);
+            }
+        }
+    }
+}
+
+/* Append a batch of records to the file in one write and sync it, then
+ * rewrite the file if most of it is records that were superseded.
+ */
+static void append(struct entry *batch) {
+    size_t len = 0;
+    for (struct entry *e = batch; e != NULL; e = e->next) {
+        len += snapshot_size(&e->rec);
+    }
+    int failed = 0;
+    char *buf = malloc(len);
+    if (buf == NULL) {
+        log_error("snapshot_write", LF_ERRNO(errno));
+        failed = 1;
+    } else {
+        size_t off = 0;
+        for (struct entry *e = batch; e != NULL; e = e->next) {
+            memcpy(buf + off, &e->rec, snapshot_size(&e->rec));
+            off += snapshot_size(&e->rec);
+        }
+        if (write_all(snap_fd, buf, len) == -1 || fdatasync(snap_fd) == -1) {
+            log_error("snapshot_write", LF_ERRNO(errno));
+            failed = 1;
+        } else {
+            file_size += len;
+        }
+        free(buf);
+    }
+
+    while (batch != NULL) {
+        struct entry *next = batch->next;
+        table_put(batch);
+        batch = next;
+    }
+
+    /* A failed write may have left part of a record at the end of the
+     * file, and anything appended after it would never be read back.
+     * Rewriting the file from the table makes good the whole batch.
+     */
+    if (failed || behind || file_size > 2 * live_size + COMPACT_MIN) {
+        if (compact() == 0) {
+            behind = 0;
+            return;
+        }
+        log_error("snapshot_compact", LF_ERRNO(errno));
+        if (failed) {
+            // Cut off the torn record so later batches stay readable; the
+            // file is rewritten after the next batch.
+            behind = 1;
+            if (ftruncate(snap_fd, file_size) == -1
+                    || lseek(snap_fd, file_size, SEEK_SET) == -1) {
+                log_error("snapshot_truncate", LF_ERRNO(errno));
+            }
+        }
+    }
+}
+
+static void *writer(void *arg) {
+    pthread_mutex_lock(&queue_lock);
+    while (1) {
+        while (queue_head == NULL) {
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        }
+        struct entry *batch = queue_head;
+        queue_head = queue_tail = NULL;
+        pthread_mutex_unlock(&queue_lock);
+        append(batch);
+        pthread_mutex_lock(&queue_lock);
+    }
+    return NULL;
+}
+
+int snapshot_start(void) {
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, writer, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void snapshot_save(const struct snapshot_room *rec) {
+    struct entry *e = malloc(offsetof(struct entry, rec) + snapshot_size(rec));
+    if (e == NULL) {
+        log_error("snapshot_save", LF_STR("room", rec->room), LF_ERRNO(errno));
+        return;
+    }
+    memcpy(&e->rec, rec, snapshot_size(rec));
+    e->rec.magic = SNAPSHOT_MAGIC;
+    e->rec.checksum = checksum(&e->rec);
+    e->next = NULL;
+
+    pthread_mutex_lock(&queue_lock);
+    if (queue_tail != NULL) {
+        queue_tail->next = e;
+    } else {
+        queue_head = e;
+    }
+    queue_tail = e;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+void snapshot_forget(const char *name) {
+    struct snapshot_room rec;
+    memset(&rec, 0, offsetof(struct snapshot_room, seats));
+    rec.kind = SNAP_GONE;
+    strncpy(rec.room, name, MAX_NAME);
+    rec.room[MAX_NAME - 1] = '\0';
+    snapshot_save(&rec);
+}
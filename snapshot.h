@@ -0,0 +1,72 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "gameplay.h"
+
+/* Snapshots of every room's game, so a restarted server carries on where
+ * it stopped instead of starting every room over.
+ *
+ * Workers note the rooms that changed and, every snapshot interval, hand
+ * one record per changed room to a writer thread; nothing in a worker
+ * waits for the disk. The writer appends the records to the snapshot file
+ * and syncs it, and rewrites the file with only the latest record of each
+ * room once it has grown to twice what that takes. Each record carries a
+ * checksum, so the part of a record a crash cut off is recognised and
+ * dropped when the file is read back at startup.
+ *
+ * A restored room keeps the seats of the players it had: their names are
+ * reserved for a grace window after startup, and a client who gives one
+ * of them is put straight back in that room (see names.h).
+ */
+
+#define SNAPSHOT_MAGIC 0x32414e53     // "SNA2"; "SNAP" files had no word_length
+#define SNAPSHOT_MAX_SEATS 64         // players remembered per room
+
+enum snapshot_kind {
+    SNAP_ROOM,                // the state of a room
+    SNAP_GONE                 // the room was closed
+};
+
+/* One record, as it is in the file. Only the first num_seats seats are
+ * written, so records are of different lengths (see snapshot_size).
+ * Players who come back take their turns in the order they came back in.
+ */
+struct snapshot_room {
+    uint32_t magic;
+    uint32_t checksum;        // FNV-1a of the rest of the record
+    uint32_t kind;
+    uint32_t num_seats;
+    char room[MAX_NAME];
+    char word[MAX_WORD];
+    int32_t word_length;      // of the room's words, 0 for any (see /match)
+    uint32_t letters_guessed;
+    int32_t guesses_left;
+    char seats[SNAPSHOT_MAX_SEATS][MAX_NAME];   // players in turn order
+};
+
+/* The bytes of rec that are written out. */
+#define snapshot_size(rec) \
+    (offsetof(struct snapshot_room, seats) + (rec)->num_seats * MAX_NAME)
+
+/* Read the snapshot file at path, if there is one, and keep the latest
+ * record of every room that was not closed. The file is then rewritten
+ * with only those. Returns -1 if the file can't be used.
+ */
+int snapshot_open(const char *path);
+/* Call fn with every room read by snapshot_open. */
+void snapshot_each(void (*fn)(const struct snapshot_room *rec));
+/* Reserve the names of the players of the rooms read by snapshot_open
+ * until time until (see timer_now_ms).
+ */
+void snapshot_hold_seats(uint64_t until);
+/* Start the thread that writes records out. Returns -1 on failure. */
+int snapshot_start(void);
+/* Queue rec (filled in but for magic and checksum) to be written out. */
+void snapshot_save(const struct snapshot_room *rec);
+/* Queue a record saying the room called name was closed. */
+void snapshot_forget(const char *name);
+
+#endif
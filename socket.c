@@ -1,12 +1,16 @@
+#define _GNU_SOURCE       /* accept4 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <arpa/inet.h>     /* inet_ntoa */
 #include <netdb.h>         /* gethostname */
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 
 #include "socket.h"
+#include "log.h"
 
 /*
  * Initialize a server address associated with the given port.
@@ -31,10 +35,12 @@ struct sockaddr_in *init_server_addr(int port) {
 
 
 /*
- * Create and set up a socket for a server to listen on.
+ * Create and set up a non-blocking socket for a server to listen on.
+ * If reuse_port is set, several sockets may listen on the same port and
+ * the kernel spreads incoming connections across them.
  */
-int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
-    int soc = socket(PF_INET, SOCK_STREAM, 0);
+int set_up_server_socket(struct sockaddr_in *self, int num_queue, int reuse_port) {
+    int soc = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (soc < 0) {
         perror("socket");
         exit(1);
@@ -50,6 +56,12 @@ int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
         exit(1);
     }
 
+    if (reuse_port && setsockopt(soc, SOL_SOCKET, SO_REUSEPORT,
+            (const char *) &on, sizeof(on)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        exit(1);
+    }
+
     // Associate the process with the address and a port
     if (bind(soc, (struct sockaddr *)self, sizeof(*self)) < 0) {
         // bind failed; could be because port is in use.
@@ -67,28 +79,53 @@ int set_up_server_socket(struct sockaddr_in *self, int num_queue) {
     return soc;
 }
 
-
 /*
- * Wait for and accept a new connection.
- * Terminate with exit code 1 if the accept call failed, otherwise return
- * the client's socket descriptor.
+ * Have the kernel hold a connection back from accept until the client has
+ * sent something, or until seconds have passed. We speak first, so clients
+ * that wait for our welcome are only accepted once the timeout expires:
+ * this is for deployments whose clients send their name straight away.
+ * Return 0 on success and -1 on failure.
  */
-int accept_connection(int listenfd) {
-    struct sockaddr_in peer;
-    unsigned int peer_len = sizeof(peer);
-    peer.sin_family = PF_INET;
-
-    printf("Waiting for a new connection...\n");
-    int client_socket = accept(listenfd, (struct sockaddr *)&peer, &peer_len);
-    if (client_socket < 0) {
-        perror("accept");
-        exit(1);
-    } else {
-        printf("New connection accepted from %s:%d\n",
-            inet_ntoa(peer.sin_addr),
-            ntohs(peer.sin_port));
-        return client_socket;
+int set_defer_accept(int soc, int seconds) {
+    if (setsockopt(soc, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds,
+                   sizeof(seconds)) < 0) {
+        perror("setsockopt TCP_DEFER_ACCEPT");
+        return -1;
     }
+    return 0;
 }
 
 
+/*
+ * Accept one pending connection without blocking and store the client's
+ * address in peer. The socket comes back non-blocking and close-on-exec.
+ * Return the client's socket descriptor, or -1 with errno set: EAGAIN
+ * once nothing is pending, EMFILE or ENFILE when out of descriptors, or
+ * an error that only concerns this one connection (e.g. ECONNABORTED).
+ */
+int accept_connection(int listenfd, struct sockaddr_in *peer) {
+    socklen_t peer_len = sizeof(*peer);
+
+    int client_socket = accept4(listenfd, (struct sockaddr *)peer, &peer_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_socket >= 0) {
+        log_debug("accepted", LF_ADDR("addr", peer->sin_addr),
+                  LF_INT("port", ntohs(peer->sin_port)));
+    }
+    return client_socket;
+}
+
+/*
+ * Prepare an accepted client socket: send our writes as soon as they are
+ * made because we already gather each client's output into one write per
+ * event loop iteration.
+ * Return 0 on success and -1 on failure.
+ */
+int set_up_client_socket(int fd) {
+    int on = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1) {
+        log_error("tcp_nodelay", LF_INT("fd", fd), LF_ERRNO(errno));
+        return -1;
+    }
+    return 0;
+}
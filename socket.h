@@ -4,7 +4,9 @@
 #include <netinet/in.h>    /* Internet domain header, for struct sockaddr_in */
 
 struct sockaddr_in *init_server_addr(int port);
-int set_up_server_socket(struct sockaddr_in *self, int num_queue);
-int accept_connection(int listenfd);
+int set_up_server_socket(struct sockaddr_in *self, int num_queue, int reuse_port);
+int set_defer_accept(int soc, int seconds);
+int accept_connection(int listenfd, struct sockaddr_in *peer);
+int set_up_client_socket(int fd);
 
 #endif
@@ -0,0 +1,172 @@
+#include <time.h>
+
+#include "timer.h"
+
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void list_init(struct timer *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_add(struct timer *head, struct timer *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void list_del(struct timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+}
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t now_ms) {
+    w->now = now_ms / TIMER_TICK_MS;
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int s = 0; s < WHEEL_SLOTS; s++) {
+            list_init(&w->slots[l][s]);
+        }
+        w->used[l] = 0;
+    }
+    w->count = 0;
+}
+
+void timer_init(struct timer *t, void (*fn)(struct timer *t)) {
+    t->wheel = NULL;
+    t->fn = fn;
+}
+
+/* Put t in the slot of the coarsest level that still tells its expiry
+ * apart from now.
+ */
+static void place(struct timer_wheel *w, struct timer *t) {
+    uint64_t expires = t->expires < w->now ? w->now : t->expires;
+    uint64_t delta = expires - w->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    // Beyond the last level a timer waits in its furthest slot.
+    if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS))) {
+        expires = w->now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+    int slot = (expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    t->level = level;
+    t->slot = slot;
+    list_add(&w->slots[level][slot], t);
+    w->used[level] |= 1ULL << slot;
+}
+
+void timer_add(struct timer_wheel *w, struct timer *t, uint64_t ms) {
+    timer_cancel(t);
+    t->expires = w->now + (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    t->wheel = w;
+    w->count++;
+    place(w, t);
+}
+
+void timer_cancel(struct timer *t) {
+    struct timer_wheel *w = t->wheel;
+    if (w == NULL) {
+        return;
+    }
+    struct timer *head = &w->slots[t->level][t->slot];
+    list_del(t);
+    if (head->next == head) {
+        w->used[t->level] &= ~(1ULL << t->slot);
+    }
+    t->wheel = NULL;
+    w->count--;
+}
+
+int timer_pending(struct timer *t) {
+    return t->wheel != NULL;
+}
+
+/* Move the timers of a slot of level down to the levels below, now that
+ * the part of the wheel they were waiting for has come round.
+ */
+static void cascade(struct timer_wheel *w, int level) {
+    int slot = (w->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    struct timer *head = &w->slots[level][slot];
+    while (head->next != head) {
+        struct timer *t = head->next;
+        list_del(t);
+        place(w, t);
+    }
+    w->used[level] &= ~(1ULL << slot);
+    if (slot == 0 && level + 1 < WHEEL_LEVELS) {
+        cascade(w, level + 1);
+    }
+}
+
+void timer_run(struct timer_wheel *w, uint64_t now_ms) {
+    uint64_t target = now_ms / TIMER_TICK_MS;
+    while (w->now <= target) {
+        if (w->count == 0) {
+            w->now = target + 1;
+            break;
+        }
+        int slot = w->now & (WHEEL_SLOTS - 1);
+        if (slot == 0) {
+            cascade(w, 1);
+        }
+
+        // Skip ahead to the next busy slot, or to the next cascade if the
+        // rest of this turn of level 0 is empty, but never past target.
+        uint64_t ahead = w->used[0] >> slot;
+        uint64_t step = ahead ? (uint64_t)__builtin_ctzll(ahead)
+                              : (uint64_t)(WHEEL_SLOTS - slot);
+        if (step > 0) {
+            w->now = w->now + step > target + 1 ? target + 1 : w->now + step;
+            continue;
+        }
+
+        // Take the slot's timers off the wheel before calling any of them,
+        // so callbacks can freely add timers, this slot included.
+        struct timer *head = &w->slots[0][slot];
+        struct timer due;
+        list_init(&due);
+        while (head->next != head) {
+            struct timer *t = head->next;
+            list_del(t);
+            list_add(&due, t);
+        }
+        w->used[0] &= ~(1ULL << slot);
+        w->now++;
+
+        while (due.next != &due) {
+            struct timer *t = due.next;
+            list_del(t);
+            t->wheel = NULL;
+            w->count--;
+            t->fn(t);
+        }
+    }
+}
+
+int timer_next_timeout(struct timer_wheel *w, uint64_t now_ms) {
+    if (w->count == 0) {
+        return -1;
+    }
+    uint64_t now = now_ms / TIMER_TICK_MS;
+    int slot = w->now & (WHEEL_SLOTS - 1);
+    uint64_t ahead = w->used[0] >> slot;
+    // Either the next busy slot of level 0, or the next cascade (which is
+    // still to come if w->now is at the start of a turn of level 0).
+    uint64_t next = w->now;
+    if (ahead != 0) {
+        next += __builtin_ctzll(ahead);
+    } else if (slot != 0) {
+        next += WHEEL_SLOTS - slot;
+    }
+    if (next <= now) {
+        return 0;
+    }
+    return (next - now) * TIMER_TICK_MS - now_ms % TIMER_TICK_MS;
+}
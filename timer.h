@@ -0,0 +1,60 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A hierarchical timer wheel: each level has WHEEL_SLOTS slots, a slot of
+ * level 0 covers one tick and a slot of level n covers all of level n - 1.
+ * Adding and cancelling a timer are O(1); a timer far in the future waits
+ * in a coarse slot and moves down a level each time its slot comes round.
+ * Each worker has its own wheel, so none of this is locked.
+ */
+
+#define TIMER_TICK_MS 10          // resolution of level 0
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4            // 64^4 ticks, over 46 hours at 10 ms
+
+struct timer_wheel;
+
+/* Embed one of these in whatever the timer is for; timer_owner finds the
+ * enclosing object again when the timer fires.
+ */
+struct timer {
+    struct timer *next;
+    struct timer *prev;
+    uint64_t expires;             // in ticks
+    struct timer_wheel *wheel;    // NULL unless pending
+    unsigned char level;
+    unsigned char slot;
+    void (*fn)(struct timer *t);
+};
+
+#define timer_owner(t, type, member) \
+    ((type *)((char *)(t) - offsetof(type, member)))
+
+struct timer_wheel {
+    uint64_t now;                 // the next tick to run, in ticks
+    struct timer slots[WHEEL_LEVELS][WHEEL_SLOTS];    // list heads
+    uint64_t used[WHEEL_LEVELS];  // bit i is set while slot i is not empty
+    int count;
+};
+
+/* Return the time in milliseconds on a monotonic clock. */
+uint64_t timer_now_ms(void);
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t now_ms);
+void timer_init(struct timer *t, void (*fn)(struct timer *t));
+/* (Re)schedule t to fire after ms milliseconds. */
+void timer_add(struct timer_wheel *w, struct timer *t, uint64_t ms);
+void timer_cancel(struct timer *t);
+int timer_pending(struct timer *t);
+/* Fire every timer due by now_ms. Callbacks may add and cancel timers. */
+void timer_run(struct timer_wheel *w, uint64_t now_ms);
+/* Return how many milliseconds the event loop may sleep before timer_run
+ * has something to do, or -1 if no timer is pending.
+ */
+int timer_next_timeout(struct timer_wheel *w, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_setup(unsigned int entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                     unsigned int flags, void *arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+int uring_init(struct uring *r, unsigned int entries, unsigned int cq_entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    p.cq_entries = cq_entries;
+    r->fd = sys_setup(entries, &p);
+    if (r->fd == -1) {
+        return -1;
+    }
+    // We rely on one mapping for both rings and on timed waits (5.11).
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(r->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->ring == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->ring, r->ring_size);
+        close(r->fd);
+        return -1;
+    }
+
+    char *base = r->ring;
+    r->sq_head = (unsigned int *)(base + p.sq_off.head);
+    r->sq_tail = (unsigned int *)(base + p.sq_off.tail);
+    r->sq_mask = *(unsigned int *)(base + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sq_queued = 0;
+    // Submission slot i always holds sqes[i], so the array is set up once.
+    unsigned int *array = (unsigned int *)(base + p.sq_off.array);
+    for (unsigned int i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    r->cq_head = (unsigned int *)(base + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(base + p.cq_off.tail);
+    r->cq_mask = *(unsigned int *)(base + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_free(struct uring *r) {
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->ring, r->ring_size);
+    close(r->fd);
+}
+
+struct io_uring_sqe *uring_sqe(struct uring *r) {
+    unsigned int head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = *r->sq_tail + r->sq_queued;
+    if (tail - head >= r->sq_entries) {
+        if (uring_enter(r, 0, -1) == -1) {
+            return NULL;
+        }
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        tail = *r->sq_tail + r->sq_queued;
+        if (tail - head >= r->sq_entries) {
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = &r->sqes[tail & r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_queued++;
+    return sqe;
+}
+
+int uring_enter(struct uring *r, unsigned int wait_nr, int timeout_ms) {
+    // Publish the queued submissions, and offer the kernel everything it
+    // has not taken yet, including any it left behind last time.
+    unsigned int tail = *r->sq_tail + r->sq_queued;
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+    r->sq_queued = 0;
+    unsigned int to_submit = tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    unsigned int flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (wait_nr > 0 && timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+        arg.ts = (unsigned long long)(uintptr_t)&ts;
+        arg.sigmask_sz = _NSIG / 8;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    int res = sys_enter(r->fd, to_submit, wait_nr, flags,
+                        (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+                        (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+    return res == -1 ? -1 : 0;
+}
+
+struct io_uring_sqe *uring_withdraw(struct uring *r) {
+    if (r->sq_queued > 0) {
+        r->sq_queued--;
+        return &r->sqes[(*r->sq_tail + r->sq_queued) & r->sq_mask];
+    }
+    unsigned int tail = *r->sq_tail;
+    if (tail == __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    tail--;
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+    return &r->sqes[tail & r->sq_mask];
+}
+
+struct io_uring_cqe *uring_cqe(struct uring *r) {
+    unsigned int head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &r->cqes[head & r->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
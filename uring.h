@@ -0,0 +1,55 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <linux/io_uring.h>
+
+/* Just enough io_uring, on the raw system calls, for the event loop's
+ * uring backend and for writing many clients' output with one system call
+ * (see outq_flush_batch): a submission queue we fill and a completion
+ * queue we drain, both in memory shared with the kernel. A ring belongs
+ * to one thread.
+ */
+struct uring {
+    int fd;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_queued;       // filled in but not yet handed to the kernel
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring;                   // both rings, in one mapping
+    size_t ring_size;
+    size_t sqes_size;
+};
+
+/* Set up r with room for entries submissions and cq_entries completions.
+ * Returns -1 (errno is set) if the kernel has no usable io_uring.
+ */
+int uring_init(struct uring *r, unsigned int entries, unsigned int cq_entries);
+void uring_free(struct uring *r);
+/* Return a cleared submission to fill in, first handing queued ones to the
+ * kernel if the queue is full. Returns NULL if that failed.
+ */
+struct io_uring_sqe *uring_sqe(struct uring *r);
+/* Hand every queued submission to the kernel, then wait until at least
+ * wait_nr completions are there or timeout_ms (-1 for no limit) passes.
+ * Returns 0, or -1 with errno set (ETIME if the wait timed out).
+ */
+int uring_enter(struct uring *r, unsigned int wait_nr, int timeout_ms);
+/* After uring_enter failed, take back the newest submission the kernel
+ * has not consumed, so it is never run, and return it; NULL once the
+ * kernel has consumed every submission. The kernel only reads the queue
+ * inside uring_enter, on the ring's own thread, so this is safe then.
+ */
+struct io_uring_sqe *uring_withdraw(struct uring *r);
+/* Return the oldest completion not yet consumed, or NULL if none. */
+struct io_uring_cqe *uring_cqe(struct uring *r);
+/* Consume the completion uring_cqe returned. */
+void uring_cqe_seen(struct uring *r);
+
+#endif
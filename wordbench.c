@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "linebuf.h"
+
+/* A load generator for wordsrv. It opens many sessions to a server on the
+ * loopback interface, answers the name and room prompts, guesses whenever
+ * it is asked to, and reports how fast connections were accepted, how many
+ * turns were played per second, and how long it took from sending a guess
+ * to receiving its broadcast.
+ */
+
+#ifndef PORT
+    #define PORT 59042
+#endif
+
+#define NAME_LEN 32
+
+enum session_state {
+    CONNECTING,     // connect() in progress
+    JOINING,        // name and room sent, waiting to be let in
+    PLAYING,        // in a room
+    DEAD            // connection failed or was closed
+};
+
+struct session {
+    int fd;
+    enum session_state state;
+    char name[NAME_LEN];
+    struct linebuf in;
+    unsigned int guessed;     // letters already guessed in the current game
+    double guess_sent;        // when our outstanding guess was sent, or 0
+};
+
+/* Guess to broadcast latencies, in microseconds. */
+struct samples {
+    unsigned int *v;
+    size_t n;
+    size_t cap;
+};
+
+static struct session *sessions;
+static int num_sessions;
+static struct samples latency;
+static long turns;
+static int joined;
+static int failed;
+static int epfd;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_sample(struct samples *s, unsigned int usec) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 4096;
+        s->v = realloc(s->v, s->cap * sizeof(unsigned int));
+        if (s->v == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->v[s->n++] = usec;
+}
+
+static int cmp_uint(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
+/* Return the q-quantile of the sorted samples. */
+static unsigned int quantile(struct samples *s, double q) {
+    if (s->n == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(q * (s->n - 1) + 0.5);
+    return s->v[i];
+}
+
+/* Close s; it counts as failed unless it had joined a room. */
+static void kill_session(struct session *s) {
+    if (s->state == DEAD) {
+        return;
+    }
+    if (s->state != PLAYING) {
+        failed++;
+    }
+    s->state = DEAD;
+    close(s->fd);
+}
+
+static void send_all(struct session *s, const char *buf) {
+    size_t len = strlen(buf);
+    // Our messages are tiny, so a full send buffer means the server is stuck.
+    if (write(s->fd, buf, len) != (ssize_t)len) {
+        kill_session(s);
+    }
+}
+
+/* Guess a random letter nobody in our room has tried in this game. */
+static void guess(struct session *s) {
+    if (s->guessed == (1u << 26) - 1) {
+        s->guessed = 0;
+    }
+    int c;
+    do {
+        c = random() % 26;
+    } while (s->guessed & (1u << c));
+    s->guessed |= 1u << c;
+
+    char buf[4] = { 'a' + c, '\r', '\n', '\0' };
+    s->guess_sent = now();
+    send_all(s, buf);
+}
+
+static void handle_line(struct session *s, char *line) {
+    char *g = strstr(line, " guesses: ");
+    if (g != NULL && g[10] >= 'a' && g[10] <= 'z') {
+        s->guessed |= 1u << (g[10] - 'a');
+        size_t len = g - line;
+        if (s->guess_sent != 0 && len == strlen(s->name)
+                && strncmp(line, s->name, len) == 0) {
+            add_sample(&latency, (unsigned int)((now() - s->guess_sent) * 1e6));
+            s->guess_sent = 0;
+            turns++;
+        }
+    } else if (strstr(line, "Let's start a new game") != NULL) {
+        s->guessed = 0;
+    } else if (strstr(line, "has just joined") != NULL && s->state == JOINING) {
+        s->state = PLAYING;
+        joined++;
+    }
+
+    // Any prompt for a guess: the first one, or after an invalid guess.
+    if (s->state == PLAYING && strstr(line, "Your guess") != NULL) {
+        guess(s);
+    }
+}
+
+static void handle_readable(struct session *s) {
+    char line[MAX_LINE + 1];
+    while (s->state != DEAD) {
+        int len;
+        while (s->state != DEAD && (len = linebuf_line(&s->in, line, sizeof(line))) >= 0) {
+            handle_line(s, line);
+        }
+        if (s->state == DEAD) {
+            return;
+        }
+        int n = linebuf_fill(&s->in, s->fd);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            kill_session(s);
+            return;
+        }
+    }
+}
+
+/* The connection is established: answer the name and room prompts at once;
+ * the server reads them one line at a time.
+ */
+static void handle_connected(struct session *s, const char *room) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+        kill_session(s);
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = s - sessions;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+
+    char buf[2 * NAME_LEN + 4];
+    snprintf(buf, sizeof(buf), "%s\r\n%s\r\n", s->name, room);
+    s->state = JOINING;
+    send_all(s, buf);
+}
+
+static int open_session(struct session *s, struct sockaddr_in *addr) {
+    s->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (s->fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    int on = 1;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    linebuf_init(&s->in);
+    s->guessed = 0;
+    s->guess_sent = 0;
+    s->state = CONNECTING;
+
+    if (connect(s->fd, (struct sockaddr *)addr, sizeof(*addr)) == -1
+            && errno != EINPROGRESS) {
+        perror("connect");
+        close(s->fd);
+        s->state = DEAD;
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLIN;
+    ev.data.u32 = s - sessions;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-p port] [-c connections] [-r players per room] "
+            "[-d seconds] [-t join timeout]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int port = PORT;
+    int per_room = 4;
+    double duration = 10;
+    double join_timeout = 10;
+    num_sessions = 100;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:c:r:d:t:")) != -1) {
+        switch (opt) {
+            case 'p': port = strtol(optarg, NULL, 10); break;
+            case 'c': num_sessions = strtol(optarg, NULL, 10); break;
+            case 'r': per_room = strtol(optarg, NULL, 10); break;
+            case 'd': duration = strtod(optarg, NULL); break;
+            case 't': join_timeout = strtod(optarg, NULL); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (num_sessions < 1 || per_room < 1 || duration <= 0) {
+        usage(argv[0]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    srandom(getpid());
+
+    // Every session needs a descriptor.
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    sessions = calloc(num_sessions, sizeof(struct session));
+    epfd = epoll_create1(0);
+    if (sessions == NULL || epfd == -1) {
+        perror("setup");
+        exit(1);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // Names only need to be unique among concurrent benchmark runs.
+    int run = getpid() % 10000;
+    double start = now();
+    for (int i = 0; i < num_sessions; i++) {
+        snprintf(sessions[i].name, NAME_LEN, "bot%d_%d", run, i);
+        if (open_session(&sessions[i], &addr) == -1) {
+            sessions[i].state = DEAD;
+            failed++;
+        }
+    }
+
+    struct epoll_event events[256];
+    double connected_at = 0;
+    double end = 0;
+    long turns_at_start = 0;
+    size_t samples_at_start = 0;
+
+    while (1) {
+        double t = now();
+        // Sessions the server never let in by the deadline count as failed.
+        if (connected_at == 0 && t - start > join_timeout) {
+            for (int i = 0; i < num_sessions; i++) {
+                if (sessions[i].state == CONNECTING || sessions[i].state == JOINING) {
+                    kill_session(&sessions[i]);
+                }
+            }
+        }
+        if (connected_at == 0 && joined + failed >= num_sessions) {
+            connected_at = t;
+            end = t + duration;
+            turns_at_start = turns;
+            samples_at_start = latency.n;
+        }
+        if (end != 0 && t >= end) {
+            break;
+        }
+        int n = epoll_wait(epfd, events, 256, 100);
+        for (int i = 0; i < n; i++) {
+            struct session *s = &sessions[events[i].data.u32];
+            if (s->state == DEAD) {
+                continue;
+            }
+            if (s->state == CONNECTING) {
+                char room[NAME_LEN];
+                snprintf(room, sizeof(room), "bench%d_%d", run,
+                         (int)(s - sessions) / per_room);
+                handle_connected(s, room);
+            } else {
+                handle_readable(s);
+            }
+        }
+    }
+
+    // Only count turns played once every session was connected.
+    double played = end - connected_at;
+    long steady_turns = turns - turns_at_start;
+    memmove(latency.v, latency.v + samples_at_start,
+            (latency.n - samples_at_start) * sizeof(unsigned int));
+    latency.n -= samples_at_start;
+    qsort(latency.v, latency.n, sizeof(unsigned int), cmp_uint);
+
+    double joining = connected_at - start;
+    printf("sessions:   %d joined, %d failed in %.3f s (%.0f accepted/s)\n",
+           joined, failed, joining, joining > 0 ? joined / joining : 0);
+    printf("turns:      %ld in %.1f s (%.0f turns/s)\n",
+           steady_turns, played, steady_turns / played);
+    printf("latency:    guess to broadcast p50 %u us, p99 %u us, p999 %u us "
+           "(%zu samples)\n",
+           quantile(&latency, 0.5), quantile(&latency, 0.99),
+           quantile(&latency, 0.999), latency.n);
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "engine.h"
+
+/* Plays games through the engine in memory, with no sockets and no server:
+ * a seeded generator picks the words and the players' guesses, so a run is
+ * repeatable. It reports how fast the rules run, and a checksum of every
+ * game's outcome that must not change unless the rules do.
+ */
+
+/* xorshift64*: small, fast, and the same on every platform. */
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/* FNV-1a over the outcome of each guess. */
+static uint64_t checksum = 0xcbf29ce484222325ULL;
+
+static void mix(unsigned int v) {
+    checksum = (checksum ^ v) * 0x100000001b3ULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [-s seed] [-g games] [-p players] [-l word length] "
+            "<dictionary filename>\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    long games = 1000000;
+    int players = 4;
+    int length = 0;               // play only words this long, if not 0
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:g:p:l:")) != -1) {
+        switch (opt) {
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 'g': games = strtol(optarg, NULL, 10); break;
+            case 'p': players = strtol(optarg, NULL, 10); break;
+            case 'l': length = strtol(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || games < 1 || players < 1
+            || length < 0 || length >= MAX_WORD) {
+        usage(argv[0]);
+    }
+
+    struct dictionary dict;
+    if (load_dictionary(&dict, argv[optind]) == -1) {
+        exit(1);
+    }
+    // xorshift must never be seeded with zero.
+    rng_state = seed ? seed : 1;
+
+    // Words of one length are a contiguous run of by_length.
+    const uint32_t *pick = NULL;
+    int choices = dict.size;
+    if (length > 0) {
+        pick = dict.by_length + dict.buckets[length];
+        choices = dict.buckets[length + 1] - dict.buckets[length];
+        if (choices == 0) {
+            fprintf(stderr, "The dictionary has no words of length %d\n", length);
+            exit(1);
+        }
+    }
+
+    long guesses = 0;
+    long won = 0;
+    long lost = 0;
+    long invalid = 0;
+    struct game g;
+    struct guess_outcome out;
+    double start = now();
+
+    for (long n = 0; n < games; n++) {
+        int index = rng_next() % choices;
+        if (pick != NULL) {
+            index = pick[index];
+        }
+        engine_new_game(&g, &dict, index);
+        mix(index);
+
+        // Players take turns; like real ones, they sometimes repeat a
+        // letter or type something that is not a letter at all.
+        int turn = 0;
+        do {
+            uint64_t r = rng_next();
+            char line[2] = { 'a' + r % 32, '\0' };
+            switch (engine_guess(&g, line, &out)) {
+                case GUESS_INVALID:
+                case GUESS_REPEATED:
+                    invalid++;
+                    break;
+                case GUESS_MISS:
+                    turn = (turn + 1) % players;
+                    // fall through
+                case GUESS_HIT:
+                    guesses++;
+                    break;
+            }
+            mix(out.result << 8 | line[0]);
+        } while (out.end == GAME_ON);
+
+        mix(out.end << 8 | turn);
+        if (out.end == GAME_WON) {
+            won++;
+        } else {
+            lost++;
+        }
+    }
+
+    double elapsed = now() - start;
+    printf("games:      %ld in %.3f s (%.0f games/s, %.0f guesses/s)\n",
+           games, elapsed, games / elapsed, guesses / elapsed);
+    printf("outcomes:   %ld won, %ld lost, %ld guesses, %ld rejected\n",
+           won, lost, guesses, invalid);
+    printf("checksum:   %016llx (seed %llu, %d players, %d words)\n",
+           (unsigned long long)checksum, (unsigned long long)seed, players,
+           dict.size);
+    return 0;
+}
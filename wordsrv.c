@@ -9,107 +9,1228 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <signal.h>
 
 #include "socket.h"
 #include "gameplay.h"
+#include "event.h"
+#include "client.h"
+#include "room.h"
+#include "worker.h"
+#include "metrics.h"
+#include "admin.h"
+#include "log.h"
+#include "timer.h"
+#include "snapshot.h"
+#include "names.h"
+#include "match.h"
+#include "iplimit.h"
 
 
 #ifndef PORT
     #define PORT 59042
 #endif
-#define MAX_QUEUE 5
+#define DEFAULT_BACKLOG 1024  // listen backlog unless WORDSRV_BACKLOG says otherwise
+#define ACCEPT_BURST 256      // connections accepted per wakeup of a listener
 #define BUF_SIZE 128
+#define MATCH_TICK 1000       // ms between looks for players who waited long enough
+#define ACCEPT_RETRY 100      // ms before accepting again after running out of descriptors
+#define MATCH_ARRIVAL 10000   // ms a matched room is held open for its players
 
 /* These are the given helper function */
-void add_player(struct client **top, int fd, struct in_addr addr);
+struct client *add_player(struct client **top, int fd, struct in_addr addr);
 void remove_player(struct client **top, int fd);
 
-/* Send the message in outbuf to all clients except special_player who is the current player. */
-void broadcast(struct game_state game, char *outbuf, struct client *special_player);
-/* This function is to loop to get a complete message from client. */
-int read_partial_input_from_client(struct client *p, char *result);
-/* Check if name already existed in game. */
-int check_dup_name(struct game_state game, char *name);
-/* Announce message msg to client, if that client is disconnected, remove him from list. */
-void send_msg_to_client(struct client *p, char *msg, struct client **list);
-/* Move the has_next_turn pointer to the next active client */
-void advance_turn(struct game_state *game);
-/* Announce the current player to guess and tell others whose turn it is. */
-void announce_guess_and_turn(struct game_state game);
-/* After guess letter c, update game->word. */
-void generate_guess(struct game_state *game, char c);
+/* Send text (or, to delta clients, delta) to all clients in room except special_player who is the current player. */
+void broadcast(struct room *room, char *text, char *delta, struct client *special_player);
+/* Queue the shared message text or delta for all clients in room except special_player. */
+void broadcast_msg(struct room *room, struct msg *text, struct msg *delta,
+                   struct client *special_player);
+/* Get the next complete line the client sent into result (size bytes). */
+int read_partial_input_from_client(struct client *p, char *result, size_t size);
+/* Handle everything client h has sent until its socket is drained. */
+void handle_input(client_handle h);
+/* Queue message text, or delta if p speaks the delta protocol, for client. */
+void send_msg_to_client(struct client *p, char *text, char *delta);
+/* Queue a reference to m on p's output queue and schedule a flush. */
+void queue_msg(struct client *p, struct msg *m);
+/* Add p to, or take it off, the worker's list of clients to flush. */
+void mark_dirty(struct client *p);
+void unmark_dirty(struct client *p);
+/* Write out every queued output and disconnect clients that fell behind. */
+void flush_clients(void);
+/* Act on the result of writing out p's output. */
+void flushed(struct client *p, int res, int err, size_t queued);
+/* Watch p's socket for input unless p is throttled, and for writability if want_write. */
+int watch_client(struct client *p, int want_write);
+/* Disconnect p, taking it out of its room if it has joined one. */
+void drop_client(struct client *p);
+/* Move the room's has_next_turn pointer to the next active client */
+void advance_turn(struct room *room);
+/* Announce the current player in room to guess and tell others whose turn it is. */
+void announce_guess_and_turn(struct room *room);
 /* Removes client from the linked list new_players without closing its socket. */
 void remove_from_newplayers(struct client **new_players, int fd);
-/* Check if letter is in the word word to be guessed. */
-int check_exist(char letter, char *word);
 /* A commonly used announce, including the guess status and announce_guess_and_turn. */
-void one_turn(struct game_state game);
-/* Start a new game. */
-void new_game(struct game_state *game, char **argv);
+void one_turn(struct room *room);
+/* Start a new game in room. */
+void new_game(struct room *room);
+/* Move a named client from new_players into the room called room_name, as
+ * a player or, if watch is set, a spectator.
+ * Returns 0 if the client was handed to the worker hosting that room. */
+int join_room(struct client **new_players, struct client *p, char *room_name, int watch);
+/* Create the room called name, which this worker holds in the directory. */
+struct room *open_room(const char *name, int word_length);
+/* Put p, who asked at the room prompt to be matched, in the queue. */
+void start_matching(struct client *p, int word_length);
+/* Send every group of waiting players that is ready to a new room. */
+void form_matches(int word_length, uint64_t waited_since);
+/* Match the players who have waited match_wait, however few they are. */
+void match_expired(struct timer *t);
+/* Handle input from a client waiting to be matched. */
+int handle_matching_input(struct client *p);
+/* Handle input from a spectator, who has nothing to say to the game. */
+int handle_spectator_input(struct client *p);
+/* Take a disconnected spectator out of the room it watches. */
+void stop_watching(struct client *p);
+/* Destroy a room nobody plays in or watches any more. */
+void close_room(struct room *room);
+/* Note that room's state changed, for its spectators to see. */
+void state_changed(struct room *room);
+/* Send the latest state of every changed room to its spectators. */
+void fan_out_spectators(void);
+/* Note that room changed, for the next snapshot to save. */
+void save_later(struct room *room);
+/* Hand a record of every room that changed to the snapshot writer. */
+void snapshot_expired(struct timer *t);
+/* Make a room of a saved record on a worker, before the workers start. */
+void restore_room(const struct snapshot_room *rec);
+/* Queue the latest state of the room p watches for it. */
+void send_state(struct client *p);
+/* Take the messages other workers have sent to this one. */
+void handle_messages(void);
+/* Accept the connections waiting on this worker's listener. */
+void accept_clients(void);
+/* Watch the listener again once there are descriptors to spare. */
+void accept_expired(struct timer *t);
+/* The body of each worker thread. */
+void *worker_run(void *arg);
+/* Hand a client to the worker hosting room_name. */
+int hand_off(struct client **new_players, struct client *p, int owner,
+             char *room_name, int watch);
+/* Take a disconnected player out of its room and hand its turn on. */
+void leave_room(struct client *p);
+/* Nobody guessed in time: pass the turn in the timer's room on. */
+void turn_expired(struct timer *t);
+/* A new client took too long to choose a name and a room. */
+void idle_expired(struct timer *t);
+/* A client's socket took none of its output for too long. */
+void write_expired(struct timer *t);
+/* A throttled client has earned another line: read on. */
+void throttle_expired(struct timer *t);
+/* Return 1 if p may send another line now, topping up its tokens first. */
+int line_allowed(struct client *p);
+/* Handle input from an active player; returns 0 once the socket is drained. */
+int handle_player_input(struct client *p);
+/* Handle a name or room from a new client; returns 0 once the socket is drained. */
+int handle_new_player_input(struct client **new_players, struct client *p);
+
+
+/* The dictionary every room's games pick words from is current_dict, and
+ * the event loop, the rooms and the new players belong to the worker
+ * running on this thread (see worker.h).
+ */
 
+/* A client with more than this many bytes of output waiting (because it
+ * does not read what we send) is disconnected. Set by WORDSRV_OUTQ_LIMIT.
+ */
+size_t outq_limit = OUTQ_HIGH_WATER;
 
-/* The set of socket descriptors for select to monitor.
- * This is a global variable because we need to remove socket descriptors
- * from allset when a write to a socket fails.
+/* Deadlines in milliseconds, 0 for none: how long a player has to make a
+ * guess, a new client has to choose a name and a room, and a socket may
+ * take none of its output. Set in seconds by WORDSRV_TURN_TIMEOUT,
+ * WORDSRV_LOGIN_TIMEOUT and WORDSRV_WRITE_TIMEOUT.
+ */
+uint64_t turn_timeout = 60 * 1000;
+uint64_t login_timeout = 60 * 1000;
+uint64_t write_timeout = 30 * 1000;
+
+/* With WORDSRV_SNAPSHOT naming a file, rooms that changed are saved to it
+ * every snapshot_interval milliseconds and restored from it at startup;
+ * their players get resume_grace milliseconds to come back to their seats.
+ * Set in seconds by WORDSRV_SNAPSHOT_INTERVAL and WORDSRV_RESUME_GRACE.
+ */
+int snapshots = 0;
+uint64_t snapshot_interval = 1000;
+uint64_t resume_grace = 60 * 1000;
+
+/* Players waiting to be matched are put in a room once room_size of them
+ * want the same word length, or once the first of them has waited
+ * match_wait milliseconds. Set by WORDSRV_ROOM_SIZE and, in seconds,
+ * WORDSRV_MATCH_WAIT.
  */
-fd_set allset;
+int room_size = 4;
+uint64_t match_wait = 5 * 1000;
+
+/* Each client's lines are taken at no more than line_rate a second, in
+ * bursts of up to line_burst; lines beyond that stay in the socket until
+ * the client has earned them, so a client sending faster than it may only
+ * fills its own socket buffer. 0 turns this off. No address may hold more
+ * than max_per_ip connections at once (0 for any number). Set by
+ * WORDSRV_LINE_RATE, WORDSRV_LINE_BURST and WORDSRV_MAX_PER_IP.
+ */
+uint64_t line_rate = 1000;
+uint64_t line_burst = 2000;
+int max_per_ip = 0;
 
-/* Add a client to the head of the linked list */
-void add_player(struct client **top, int fd, struct in_addr addr) {
-    struct client *p = malloc(sizeof(struct client));
+/* Add a client to the head of the linked list. Returns NULL if there is
+ * no room for another client; fd is then still the caller's.
+ */
+struct client *add_player(struct client **top, int fd, struct in_addr addr) {
+    struct client *p = client_alloc();
 
     if (!p) {
-        perror("malloc");
-        exit(1);
+        return NULL;
     }
 
-    printf("Adding client %s\n", inet_ntoa(addr));
+    log_info("client_added", LF_ADDR("addr", addr), LF_INT("fd", fd));
 
     p->fd = fd;
     p->ipaddr = addr;
+    p->state = CLIENT_NEW;
+    p->room = NULL;
     p->name[0] = '\0';
-    p->in_ptr = p->inbuf;
-    p->inbuf[0] = '\0';
-    p->next = *top;
-    *top = p;
+    p->proto = PROTO_TEXT;
+    p->word_length = 0;
+    linebuf_init(&p->in);
+    outq_init(&p->out);
+    p->want_write = 0;
+    p->closing = 0;
+    p->dirty = 0;
+    timer_init(&p->idle_timer, idle_expired);
+    timer_init(&p->write_timer, write_expired);
+    p->tokens = line_burst * 1000;
+    p->refilled = worker->timers.now * TIMER_TICK_MS;
+    timer_init(&p->throttle_timer, throttle_expired);
+    p->throttled = 0;
+    p->warned_turn = 0;
+    if (client_table_set(fd, p) == -1) {
+        client_free(p);
+        return NULL;
+    }
+    push_client(top, p);
+    if (login_timeout > 0) {
+        timer_add(&worker->timers, &p->idle_timer, login_timeout);
+    }
+    return p;
 }
 
 /* Removes client from the linked list and closes its socket.
- * Also removes socket descriptor from allset 
+ * Also removes socket descriptor from the event loop
  */
 void remove_player(struct client **top, int fd) {
-    struct client **p;
-
-    for (p = top; *p && (*p)->fd != fd; p = &(*p)->next)
-        ;
-    // Now, p points to (1) top, or (2) a pointer to another client
-    // This avoids a special case for removing the head of the list
-    if (*p) {
-        struct client *t = (*p)->next;
-        printf("Removing client %d %s\n", fd, inet_ntoa((*p)->ipaddr));
-        FD_CLR((*p)->fd, &allset);
-        close((*p)->fd);
-        free(*p);
-        *p = t;
+    struct client *p = client_lookup(fd);
+
+    if (p) {
+        log_info("client_removed", LF_ADDR("addr", p->ipaddr), LF_INT("fd", fd));
+        if (p->name[0] != '\0') {
+            name_registry_release(p->name);
+        }
+        if (p->state == CLIENT_MATCHING) {
+            match_cancel(client_handle_of(p), p->word_length);
+        }
+        unlink_client(top, p);
+        unmark_dirty(p);
+        timer_cancel(&p->idle_timer);
+        timer_cancel(&p->write_timer);
+        timer_cancel(&p->throttle_timer);
+        outq_free(&p->out);
+        client_table_clear(fd);
+        event_del(worker->loop, fd);
+        close(fd);
+        ip_limit_release(p->ipaddr);
+        client_free(p);
+        // Another worker may have taken the spare we gave up; have it back.
+        if (worker->spare_fd == -1) {
+            worker->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        metrics_add(&worker->metrics, M_CONN_CLOSED, 1);
     } else {
-        fprintf(stderr, "Trying to remove fd %d, but I don't know about it\n",
-                 fd);
+        log_warn("remove_unknown_client", LF_INT("fd", fd));
     }
 }
 
 
-int main(int argc, char **argv) {
-    int clientfd, maxfd, nready;
+/* Handle one complete (or partial) message from an active player.
+ * Returns 1 if more input may be waiting on the socket, 0 if the socket has
+ * been drained or the player has been removed.
+ */
+int handle_player_input(struct client *p) {
+    struct room *room = p->room;
+    struct game_state *game = &room->game;
+
+    //A player send messages not during his turn
+    if (p->fd != game->has_next_turn->fd) {
+
+        char garbage[MAX_BUF];
+        int res = read_partial_input_from_client(p, garbage, sizeof(garbage));
+
+        // Told once a turn, however much it sends before the turn changes.
+        if (res == 1 && p->warned_turn != room->turns) {
+            p->warned_turn = room->turns;
+            send_msg_to_client(p, "It is not your turn.\r\n", "error=not_your_turn\r\n");
+            log_debug("out_of_turn", LF_STR("player", p->name));
+        } 
+
+        else if (res == -1) {// This client is gone.
+            leave_room(p);
+            return 0;
+        }
+        return res != 3;
+    } 
+
+    //Player sends messages during his turn
+    char guess[MAX_BUF];
+    int res = read_partial_input_from_client(p, guess, sizeof(guess));
+    switch (res) {
+
+        case -1:
+        {// This client gone during his turn.
+            leave_room(p);
+            return 0;
+        }
+
+        case 0:// Player sent empty guess letter.
+        case 1:
+        {
+            struct guess_outcome out;
+            switch (engine_guess(&game->board, guess, &out)) {
+                case GUESS_INVALID:
+                    send_msg_to_client(p, "Invalid guess. Your guess?\r\n", "error=invalid\r\n");
+                    return 1;
+                case GUESS_REPEATED:
+                    send_msg_to_client(p, "Already guessed. Your guess again?\r\n",
+                                       "error=repeated\r\n");
+                    return 1;
+                case GUESS_MISS:
+                {
+                    char wrong_guess[MAX_MSG];
+                    sprintf(wrong_guess, "%c is not in the word\r\n", out.letter);
+                    // notify server
+                    log_debug("miss", LF_STR("room", room->name),
+                              LF_CHAR("letter", out.letter));
+                    send_msg_to_client(p, wrong_guess, NULL);
+                    advance_turn(room);
+                    break;
+                }
+                case GUESS_HIT:
+                    break;
+            }
+            metrics_add(&worker->metrics, M_GUESSES, 1);
+            // The next turn gets a whole deadline, even if it is p's again.
+            timer_cancel(&room->turn_timer);
+
+            // Delta clients get the guess and what it changed in one line
+            // instead of the whole banner.
+            char who_guess_what[MAX_BUF];
+            sprintf(who_guess_what, "%s guesses: %c\r\n", p->name, out.letter);
+            char what_changed[MAX_MSG];
+            delta_guess(what_changed, &game->board, &out, p->name);
+            broadcast(room, who_guess_what, what_changed, NULL);
+            game_changed(game);
+            broadcast_msg(room, status_banner(game), NULL, NULL);
+            state_changed(room);
+            save_later(room);
+
+            // game ends when a player guesses the last hidden letter.
+            if(out.end == GAME_WON){
+
+                char who_won[MAX_BUF];
+                sprintf(who_won, "won player=%s\r\n", p->name);
+                send_msg_to_client(p, "Game over! You win!\r\n\r\n", who_won);
+                broadcast(room, NULL, who_won, p);
+                sprintf(who_won, "Game over! %s won!\r\n\r\n", p->name);
+                // notify server
+                log_info("game_won", LF_STR("room", room->name),
+                         LF_STR("player", p->name));
+                broadcast(room, who_won, NULL, p);
+                metrics_add(&worker->metrics, M_GAMES_FINISHED, 1);
+
+                // new game message
+                new_game(room);
+            }
+
+            // game ends when the players have zero guesses remaining.
+            else if(out.end == GAME_LOST){
+
+                char no_left[MAX_BUF];
+                sprintf(no_left, "No guesses left. Game over.\r\n\r\n");
+                log_info("game_lost", LF_STR("room", room->name));
+                broadcast(room, no_left, "lost\r\n", NULL);
+                metrics_add(&worker->metrics, M_GAMES_FINISHED, 1);
+
+                // new game message
+                new_game(room);
+            }
+
+            // game does not end.
+            else{
+                announce_guess_and_turn(room);
+            }
+            break;
+        }
+    }
+    return res != 3;
+}
+
+/* Handle input from a new client who has not yet entered a valid name,
+ * or who has a name and is choosing a room.
+ * Returns 1 if more input may be waiting on the socket, 0 if the socket has
+ * been drained or the client has been removed.
+ */
+int handle_new_player_input(struct client **new_players, struct client *p) {
+    char name[MAX_NAME];
+    int res = read_partial_input_from_client(p, name, sizeof(name));
+    switch (res) {
+
+        case -1:
+        {// client gone before entering name.
+            log_info("left_unnamed", LF_INT("fd", p->fd));
+            remove_player(new_players, p->fd);
+            return 0;
+        }
+
+        case 0:
+        {// client input an empty string as name, or wants the lobby.
+            if (p->state == CLIENT_CHOOSING_ROOM) {
+                p->word_length = 0;
+                if (!join_room(new_players, p, DEFAULT_ROOM, 0)) {
+                    return 0;
+                }
+                break;
+            }
+            send_msg_to_client(p, WELCOME_MSG, DELTA_NAME_MSG);
+            break;
+        }
+
+        case 1:
+        {// client input a valid string as name or room
+            if (p->state == CLIENT_CHOOSING_ROOM) {
+                size_t cmd = strlen(MATCH_CMD);
+                if (strncmp(name, MATCH_CMD, cmd) == 0
+                        && (name[cmd] == '\0' || name[cmd] == ' ')) {
+                    char *end;
+                    long length = strtol(name + cmd, &end, 10);
+                    while (*end == ' ') {
+                        end++;
+                    }
+                    if (*end != '\0' || length < 0 || length >= MAX_WORD) {
+                        send_msg_to_client(p, "That is not a word length. " ROOM_MSG,
+                                           "error=invalid\r\n" DELTA_ROOM_MSG);
+                        break;
+                    }
+                    start_matching(p, length);
+                    break;
+                }
+
+                int watch = strncmp(name, WATCH_CMD, strlen(WATCH_CMD)) == 0
+                    && (name[strlen(WATCH_CMD)] == '\0' || name[strlen(WATCH_CMD)] == ' ');
+                char *room_name = name;
+                if (watch) {
+                    room_name += strlen(WATCH_CMD);
+                    while (*room_name == ' ') {
+                        room_name++;
+                    }
+                    if (*room_name == '\0') {
+                        room_name = DEFAULT_ROOM;
+                    }
+                }
+                p->word_length = 0;
+                if (!join_room(new_players, p, room_name, watch)) {
+                    return 0;
+                }
+                break;
+            }
+
+            // A client that would rather have deltas says so before its name.
+            if (strcmp(name, DELTA_HELLO) == 0) {
+                p->proto = PROTO_DELTA;
+                send_msg_to_client(p, NULL, "proto=delta\r\n" DELTA_NAME_MSG);
+                break;
+            }
+
+            // Someone anywhere on the server has the name already, in
+            // any case. Whoever a reserved name was kept for gets it.
+            char seat[MAX_NAME];
+            int claimed = name_registry_claim(name, seat);
+            if (claimed == -1) {
+                send_msg_to_client(p, WELCOME_MSG, "error=name_taken\r\n" DELTA_NAME_MSG);
+                break;
+            }
+
+            strncpy(p->name, name, MAX_NAME);
+            p->state = CLIENT_CHOOSING_ROOM;
+
+            // A player of a room restored from a snapshot goes straight back.
+            if (claimed == 1) {
+                log_info("resumed", LF_STR("room", seat), LF_STR("player", name));
+                char back[MAX_MSG];
+                sprintf(back, "Welcome back. Returning you to %s.\r\n", seat);
+                char delta[MAX_MSG];
+                sprintf(delta, "resume=%s\r\n", seat);
+                send_msg_to_client(p, back, delta);
+                if (!join_room(new_players, p, seat, 0)) {
+                    return 0;
+                }
+                break;
+            }
+            send_msg_to_client(p, ROOM_MSG, DELTA_ROOM_MSG);
+            break;
+        }
+    }
+    return res != 3;
+}
+
+/* Move a named client from new_players into the room called room_name,
+ * creating the room (and its first game) if nobody is playing there yet.
+ * A spectator (watch set) is put on the room's spectators instead of in
+ * the turn order. If another worker hosts the room, the client is handed
+ * to that worker and 0 is returned: the caller must not touch the client
+ * again. Otherwise return 1.
+ */
+int join_room(struct client **new_players, struct client *p, char *room_name, int watch) {
+    struct room *room = room_lookup(&worker->rooms, room_name);
+    if (room == NULL) {
+        int owner = room_directory_claim(room_name, worker->id);
+        if (owner != worker->id && owner != -1) {
+            return hand_off(new_players, p, owner, room_name, watch);
+        }
+        if (owner != -1) {
+            room = open_room(room_name, p->word_length);
+        }
+        if (room == NULL) {
+            if (owner != -1) {
+                room_directory_release(room_name, worker->id);
+            }
+            // A matched player sent back to choose is no longer matched.
+            p->word_length = 0;
+            send_msg_to_client(p, "Could not create that room. " ROOM_MSG,
+                               "error=room_unavailable\r\n" DELTA_ROOM_MSG);
+            return 1;
+        }
+    }
+    struct game_state *game = &room->game;
+
+    remove_from_newplayers(new_players, p->fd);
+
+    if (watch) {
+        push_client(&room->spectators, p);
+        p->state = CLIENT_WATCHING;
+        p->room = room;
+        p->behind = 0;
+        room->num_spectators++;
+        timer_cancel(&p->idle_timer);
+        log_info("watching", LF_STR("room", room->name), LF_STR("player", p->name));
+
+        char watching[MAX_MSG];
+        sprintf(watching, "You are watching %s.\r\n", room->name);
+        char delta[MAX_MSG];
+        sprintf(delta, "watching=%s\r\n", room->name);
+        send_msg_to_client(p, watching, delta);
+        send_state(p);
+        return 1;
+    }
+
+    if (game->has_next_turn == NULL && game->head == NULL) {
+        game->has_next_turn = p;
+    }
+    else if (game->has_next_turn == NULL && game->head != NULL) {
+        log_error("no_turn", LF_STR("room", room->name));
+    }
+
+    push_client(&game->head, p);
+    p->state = CLIENT_PLAYING;
+    p->room = room;
+    room->num_players++;
+    __atomic_fetch_add(&worker->players, 1, __ATOMIC_RELAXED);
+    timer_cancel(&p->idle_timer);
+
+    // notify server
+    log_info("joined", LF_STR("room", room->name), LF_STR("player", p->name));
+
+    // notify clients
+    char new_player[MAX_MSG];
+    sprintf(new_player, "%s has just joined\r\n", p->name);
+    char joined[MAX_MSG];
+    sprintf(joined, "joined=%s\r\n", p->name);
+    broadcast(room, new_player, joined, NULL);
+    one_turn(room);
+    announce_guess_and_turn(room);
+    return 1;
+}
+
+/* Create the room called name, with words word_length letters long (0 for
+ * any), and its first game. Returns NULL if out of memory.
+ */
+struct room *open_room(const char *name, int word_length) {
+    struct room *room = room_create(&worker->rooms, name, worker->dict, word_length);
+    if (room == NULL) {
+        return NULL;
+    }
+    timer_init(&room->turn_timer, turn_expired);
+    log_info("room_created", LF_STR("room", room->name));
+    metrics_add(&worker->metrics, M_GAMES_STARTED, 1);
+    return room;
+}
+
+/* Give client p to worker owner, which hosts room_name. The client stops
+ * being watched by this worker before the message is sent.
+ * Returns 0, or 1 if the client could not be handed off and stays here.
+ */
+int hand_off(struct client **new_players, struct client *p, int owner,
+             char *room_name, int watch) {
+    struct message *msg = malloc(sizeof(struct message));
+    if (msg == NULL) {
+        log_error("malloc", LF_ERRNO(errno));
+        send_msg_to_client(p, "Could not join that room. " ROOM_MSG,
+                           "error=room_unavailable\r\n" DELTA_ROOM_MSG);
+        return 1;
+    }
+    msg->type = MSG_JOIN_ROOM;
+    msg->client = p;
+    strncpy(msg->room, room_name, MAX_NAME);
+    msg->room[MAX_NAME - 1] = '\0';
+    msg->watch = watch;
+
+    remove_from_newplayers(new_players, p->fd);
+    unmark_dirty(p);
+    event_del(worker->loop, p->fd);
+    p->want_write = 0;
+    // Timers live on this worker's wheel; the receiver sets its own.
+    timer_cancel(&p->idle_timer);
+    timer_cancel(&p->write_timer);
+    timer_cancel(&p->throttle_timer);
+    // Events this worker still has for the client are not its own any more.
+    client_retag(p);
+    log_info("hand_off", LF_STR("player", p->name), LF_STR("room", msg->room),
+             LF_INT("to", owner));
+    if (channel_send(&workers[owner], msg) == -1) {
+        // The receiver can still pick the message up on a later wakeup.
+        log_error("wake_worker", LF_INT("to", owner), LF_ERRNO(errno));
+    }
+    return 0;
+}
+
+/* Take a disconnected player out of its room, close its socket, say goodbye
+ * to the others and start the next turn. The room is destroyed once the
+ * last player has left, unless someone watches it or it is held open.
+ */
+void leave_room(struct client *p) {
+    struct room *room = p->room;
+    struct game_state *game = &room->game;
+
+    char goodbye[MAX_MSG];
+    sprintf(goodbye, "Goodbye %s\r\n", p->name);
+    char left[MAX_MSG];
+    sprintf(left, "left=%s\r\n", p->name);
+    if (game->has_next_turn == p) {
+        advance_turn(room);
+    }
+    remove_player(&game->head, p->fd);
+    room->num_players--;
+    __atomic_fetch_sub(&worker->players, 1, __ATOMIC_RELAXED);
+
+    // The last player disconnected. The game waits for the next one
+    // while anyone is still watching it, or while it is held open.
+    if (game->head == NULL) {
+        game->has_next_turn = NULL;
+        room->timed_player = NULL;
+        timer_cancel(&room->turn_timer);
+        uint64_t now = timer_now_ms();
+        if (room->held_until > now) {
+            // turn_expired closes it then if nobody has come.
+            timer_add(&worker->timers, &room->turn_timer, room->held_until - now);
+        } else if (room->spectators == NULL) {
+            close_room(room);
+        }
+        return;
+    }
+
+    save_later(room);
+    // announce all clients who disconnected.
+    broadcast(room, goodbye, left, NULL);
+    // start a next turn.
+    announce_guess_and_turn(room);
+}
+
+
+/* Destroy room, which nobody plays in or watches any more. */
+void close_room(struct room *room) {
+    if (room->state_changed) {
+        struct room **r = &worker->changed;
+        while (*r != room) {
+            r = &(*r)->changed_next;
+        }
+        *r = room->changed_next;
+    }
+    if (room->unsaved) {
+        struct room **r = &worker->unsaved;
+        while (*r != room) {
+            r = &(*r)->unsaved_next;
+        }
+        *r = room->unsaved_next;
+    }
+    if (snapshots) {
+        snapshot_forget(room->name);
+    }
+    log_info("room_empty", LF_STR("room", room->name));
+    room_directory_release(room->name, worker->id);
+    room_destroy(&worker->rooms, room);
+}
+
+/* Queue p for a game with words word_length letters long (0 for any), and
+ * see whether that already makes a group. p stays on new_players until
+ * its group is formed; see handle_messages.
+ */
+void start_matching(struct client *p, int word_length) {
+    if (match_enqueue(client_handle_of(p), worker->id, word_length) == -1) {
+        send_msg_to_client(p, "Could not look for players. " ROOM_MSG,
+                           "error=room_unavailable\r\n" DELTA_ROOM_MSG);
+        return;
+    }
+    p->word_length = word_length;
+    p->state = CLIENT_MATCHING;
+    log_info("matching", LF_STR("player", p->name), LF_INT("length", word_length));
+    send_msg_to_client(p, "Looking for other players...\r\n", "matching\r\n");
+    uint64_t now = timer_now_ms();
+    form_matches(word_length, now > match_wait ? now - match_wait : 0);
+}
+
+/* Take every group that is ready off the queue for word_length and give
+ * each a new room on the worker with the fewest players. The room's name
+ * is claimed for that worker, which is told to create the room at once,
+ * so every member, whichever worker it is on, is sent there by join_room;
+ * each member's own worker is told to move it, since only that worker may
+ * touch it. The room is held open for MATCH_ARRIVAL, and closed then if
+ * every member left on the way.
+ */
+void form_matches(int word_length, uint64_t waited_since) {
+    static unsigned int seq = 0;
+    struct match_entry *group;
+    int n;
+    while ((group = match_take(word_length, room_size, waited_since, &n)) != NULL) {
+        int host = 0;
+        for (int i = 1; i < num_workers; i++) {
+            if (__atomic_load_n(&workers[i].players, __ATOMIC_RELAXED)
+                    < __atomic_load_n(&workers[host].players, __ATOMIC_RELAXED)) {
+                host = i;
+            }
+        }
+        // Skip names someone already took for a room of their own.
+        char room_name[MAX_NAME];
+        int owner;
+        do {
+            snprintf(room_name, sizeof(room_name), "match-%u",
+                     __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED));
+            owner = room_directory_claim(room_name, host);
+        } while (owner != host && owner != -1);
+        log_info("matched", LF_STR("room", room_name), LF_INT("players", n),
+                 LF_INT("length", word_length), LF_INT("host", host));
+        struct message *create = owner == host ? malloc(sizeof(struct message)) : NULL;
+        if (create != NULL) {
+            create->type = MSG_CREATE_ROOM;
+            create->client = NULL;
+            create->handle = 0;
+            memcpy(create->room, room_name, MAX_NAME);
+            create->watch = 0;
+            create->word_length = word_length;
+            if (channel_send(&workers[host], create) == -1) {
+                log_error("wake_worker", LF_INT("to", host), LF_ERRNO(errno));
+            }
+        } else if (owner == host) {
+            // Nobody would close a room made for an empty group: leave
+            // the name free for the first member to arrive to claim.
+            log_error("malloc", LF_ERRNO(errno));
+            room_directory_release(room_name, host);
+        }
+
+        while (group != NULL) {
+            struct match_entry *next = group->next;
+            struct message *msg = malloc(sizeof(struct message));
+            if (msg == NULL) {
+                // It waits on until its login deadline.
+                log_error("malloc", LF_ERRNO(errno));
+            } else {
+                msg->type = MSG_MATCHED;
+                msg->client = NULL;
+                msg->handle = group->client;
+                memcpy(msg->room, room_name, MAX_NAME);
+                msg->watch = 0;
+                msg->word_length = word_length;
+                if (channel_send(&workers[group->worker], msg) == -1) {
+                    log_error("wake_worker", LF_INT("to", group->worker), LF_ERRNO(errno));
+                }
+            }
+            free(group);
+            group = next;
+        }
+    }
+}
+
+/* The queues are shared, so one worker's timer serves them all. */
+void match_expired(struct timer *t) {
+    uint64_t now = timer_now_ms();
+    for (int length = 0; length < MAX_WORD; length++) {
+        form_matches(length, now > match_wait ? now - match_wait : 0);
+    }
+    timer_add(&worker->timers, t, MATCH_TICK);
+}
+
+/* A client waiting to be matched has nothing to say until it is; any line
+ * it sends is only answered. Returns 1 if more input may be waiting.
+ */
+int handle_matching_input(struct client *p) {
+    char line[MAX_BUF];
+    int res = read_partial_input_from_client(p, line, sizeof(line));
+    if (res == -1) {
+        log_info("left_matching", LF_STR("player", p->name));
+        remove_player(&worker->new_players, p->fd);
+        return 0;
+    }
+    if (res == 0 || res == 1) {
+        send_msg_to_client(p, "Still looking for players.\r\n", "matching\r\n");
+    }
+    return res != 3;
+}
+
+/* Spectators can't guess or talk to the players; any line they send is
+ * only answered. Returns 1 if more input may be waiting on the socket.
+ */
+int handle_spectator_input(struct client *p) {
+    char line[MAX_BUF];
+    int res = read_partial_input_from_client(p, line, sizeof(line));
+    if (res == -1) {
+        stop_watching(p);
+        return 0;
+    }
+    if (res == 1) {
+        send_msg_to_client(p, "You are only watching.\r\n", "error=watching\r\n");
+    }
+    return res != 3;
+}
+
+/* Take a disconnected spectator off its room's spectators and close its
+ * socket. The players are not told. A room nobody plays in is destroyed
+ * with its last spectator, unless it is held open.
+ */
+void stop_watching(struct client *p) {
+    struct room *room = p->room;
+    log_info("stopped_watching", LF_STR("room", room->name), LF_STR("player", p->name));
+    remove_player(&room->spectators, p->fd);
+    room->num_spectators--;
+    if (room->spectators == NULL && room->game.head == NULL
+            && room->held_until <= timer_now_ms()) {
+        close_room(room);
+    }
+}
+
+/* Note that the state of the game in room changed. Its spectators are not
+ * sent anything until the end of the batch, so however often the state
+ * changes meanwhile, they are sent it once.
+ */
+void state_changed(struct room *room) {
+    if (room->spectators == NULL || room->state_changed) {
+        return;
+    }
+    room->state_changed = 1;
+    room->changed_next = worker->changed;
+    worker->changed = room;
+}
+
+/* Send every room that changed during this batch's latest state to its
+ * spectators. A spectator still draining earlier output is only marked
+ * behind: it is sent the state that is latest once its output has gone
+ * out (see flushed), and every state in between is skipped. Its queue so
+ * never holds more than one state, and however slow it reads, it costs
+ * the players nothing.
+ */
+void fan_out_spectators(void) {
+    while (worker->changed != NULL) {
+        struct room *room = worker->changed;
+        worker->changed = room->changed_next;
+        room->state_changed = 0;
+
+        struct msg *text = status_banner(&room->game);
+        struct msg *delta = delta_state(&room->game);
+        for (struct client *p = room->spectators; p != NULL; p = p->next) {
+            if (p->out.bytes > 0) {
+                p->behind = 1;
+            } else {
+                queue_msg(p, p->proto == PROTO_DELTA ? delta : text);
+            }
+        }
+    }
+}
+
+void send_state(struct client *p) {
+    struct game_state *game = &p->room->game;
+    queue_msg(p, p->proto == PROTO_DELTA ? delta_state(game) : status_banner(game));
+}
+
+void save_later(struct room *room) {
+    if (!snapshots || room->unsaved) {
+        return;
+    }
+    room->unsaved = 1;
+    room->unsaved_next = worker->unsaved;
+    worker->unsaved = room;
+}
+
+/* Save every room of this worker that changed since the last snapshot. A
+ * room that changes many times in an interval is saved once.
+ */
+void snapshot_expired(struct timer *t) {
+    struct snapshot_room rec;
+    while (worker->unsaved != NULL) {
+        struct room *room = worker->unsaved;
+        worker->unsaved = room->unsaved_next;
+        room->unsaved = 0;
+
+        struct game *g = &room->game.board;
+        memset(&rec, 0, offsetof(struct snapshot_room, seats));
+        rec.kind = SNAP_ROOM;
+        memcpy(rec.room, room->name, MAX_NAME);
+        memcpy(rec.word, g->word, MAX_WORD);
+        rec.word_length = room->word_length;
+        rec.letters_guessed = g->letters_guessed;
+        rec.guesses_left = g->guesses_left;
+        for (struct client *p = room->game.head;
+             p != NULL && rec.num_seats < SNAPSHOT_MAX_SEATS; p = p->next) {
+            memcpy(rec.seats[rec.num_seats++], p->name, MAX_NAME);
+        }
+        snapshot_save(&rec);
+    }
+    timer_add(&worker->timers, &worker->snapshot_timer, snapshot_interval);
+}
+
+/* Rooms are spread over the workers in turn. The room keeps the game it
+ * had; its players come back to it by name (see names.h), and
+ * it is closed if none has by the end of the grace window.
+ */
+void restore_room(const struct snapshot_room *rec) {
+    static int next_worker = 0;
+    struct worker *w = &workers[next_worker];
+    if (room_lookup(&w->rooms, rec->room) != NULL
+            || room_directory_claim(rec->room, w->id) != w->id) {
+        return;
+    }
+    // A matched room goes on picking words of the length it was matched for.
+    int word_length = rec->word_length > 0 && rec->word_length < MAX_WORD
+                      ? rec->word_length : 0;
+    struct room *room = room_create(&w->rooms, rec->room, current_dict, word_length);
+    if (room == NULL) {
+        room_directory_release(rec->room, w->id);
+        return;
+    }
+    next_worker = (next_worker + 1) % num_workers;
+    // A game that can't go on (say, one from another MAX_WORD) starts over.
+    if (engine_resume_game(&room->game.board, rec->word, rec->letters_guessed,
+                           rec->guesses_left) == -1) {
+        log_warn("snapshot_game_dropped", LF_STR("room", room->name));
+    }
+    timer_init(&room->turn_timer, turn_expired);
+    room->held_until = timer_now_ms() + resume_grace;
+    timer_add(&w->timers, &room->turn_timer, resume_grace);
+    log_info("room_restored", LF_STR("room", room->name),
+             LF_INT("seats", rec->num_seats));
+}
+
+/* Take the messages other workers have sent to this one. */
+void handle_messages(void) {
+    struct message *msg = channel_take(&worker->channel);
+    while (msg != NULL) {
+        struct message *next = msg->next;
+        switch (msg->type) {
+            case MSG_JOIN_ROOM:
+            {// a client handed over by another worker to join a room here
+                struct client *p = msg->client;
+                push_client(&worker->new_players, p);
+                if (event_add(worker->loop, p->fd, EV_READ | EV_EDGE) == -1) {
+                    log_error("event_add", LF_INT("fd", p->fd), LF_ERRNO(errno));
+                    remove_player(&worker->new_players, p->fd);
+                    break;
+                }
+                if (p->out.bytes > 0) {
+                    mark_dirty(p);
+                }
+                // Lines that arrived with the room name are already buffered
+                // and won't raise another edge.
+                if (join_room(&worker->new_players, p, msg->room, msg->watch)) {
+                    // The room could not be made here after all: the client
+                    // gets a new deadline to choose another.
+                    if (p->state != CLIENT_PLAYING && p->state != CLIENT_WATCHING
+                            && login_timeout > 0) {
+                        timer_add(&worker->timers, &p->idle_timer, login_timeout);
+                    }
+                    handle_input(client_handle_of(p));
+                }
+                break;
+            }
+            case MSG_CREATE_ROOM:
+            {// a room for matched players, who are on their way here
+                if (room_lookup(&worker->rooms, msg->room) != NULL) {
+                    break;
+                }
+                struct room *room = open_room(msg->room, msg->word_length);
+                if (room == NULL) {
+                    // The first of them to arrive claims the name for itself.
+                    room_directory_release(msg->room, worker->id);
+                    break;
+                }
+                room->held_until = timer_now_ms() + MATCH_ARRIVAL;
+                timer_add(&worker->timers, &room->turn_timer, MATCH_ARRIVAL);
+                break;
+            }
+            case MSG_MATCHED:
+            {// a client waiting here was matched into a room
+                struct client *p = client_get(msg->handle);
+                if (p == NULL || p->closing || p->state != CLIENT_MATCHING) {
+                    break;
+                }
+                p->state = CLIENT_CHOOSING_ROOM;
+                char found[MAX_MSG];
+                sprintf(found, "Found a game in %s.\r\n", msg->room);
+                char delta[MAX_MSG];
+                sprintf(delta, "matched=%s\r\n", msg->room);
+                send_msg_to_client(p, found, delta);
+                join_room(&worker->new_players, p, msg->room, 0);
+                break;
+            }
+        }
+        free(msg);
+        msg = next;
+    }
+}
+
+/* Handle everything the client on fd has sent until its socket is drained.
+ * The client is looked up again in the fd table before every line because
+ * handling a line may remove it (or move it from new_players to a room).
+ */
+void handle_input(client_handle h) {
+    struct client *p;
+    int more = 1;
+    while (more && (p = client_get(h)) != NULL && !p->closing) {
+        if (p->state == CLIENT_PLAYING) {
+            more = handle_player_input(p);
+        } else if (p->state == CLIENT_WATCHING) {
+            more = handle_spectator_input(p);
+        } else if (p->state == CLIENT_MATCHING) {
+            more = handle_matching_input(p);
+        } else {
+            more = handle_new_player_input(&worker->new_players, p);
+        }
+    }
+}
+
+/* We ran out of descriptors with connections still waiting. Give up the
+ * spare descriptor kept for this, accept the oldest connection and close
+ * it at once: the client learns it can't get in instead of waiting in the
+ * backlog, and the listener stops reporting a connection we can't take.
+ *
+ * The descriptor table is shared by every worker, so another one may take
+ * the descriptor we free, and the spare can't be had back. Without one,
+ * the level-triggered listener would wake us again at once for nothing:
+ * it is not watched until accept_expired finds a descriptor to spare.
+ */
+static void shed_connection(void) {
+    if (worker->spare_fd != -1) {
+        close(worker->spare_fd);
+        struct sockaddr_in peer;
+        int fd = accept_connection(worker->listenfd, &peer);
+        if (fd != -1) {
+            log_warn("out_of_descriptors", LF_ADDR("addr", peer.sin_addr));
+            metrics_add(&worker->metrics, M_CONN_REJECTED, 1);
+            close(fd);
+        }
+        worker->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    if (worker->spare_fd == -1 && !timer_pending(&worker->accept_timer)) {
+        log_warn("accept_paused", LF_INT("fd", worker->listenfd), LF_INT("retry_ms", ACCEPT_RETRY));
+        if (event_del(worker->loop, worker->listenfd) == -1) {
+            log_error("event_del", LF_INT("fd", worker->listenfd), LF_ERRNO(errno));
+        }
+        timer_add(&worker->timers, &worker->accept_timer, ACCEPT_RETRY);
+    }
+}
+
+void accept_expired(struct timer *t) {
+    if (worker->spare_fd == -1) {
+        worker->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    if (worker->spare_fd == -1 || event_add(worker->loop, worker->listenfd, EV_READ) == -1) {
+        timer_add(&worker->timers, t, ACCEPT_RETRY);
+        return;
+    }
+    log_info("accept_resumed", LF_INT("fd", worker->listenfd));
+}
+
+/* Accept up to ACCEPT_BURST connections, stopping early once the backlog
+ * is empty. The listener is level-triggered, so if more are waiting we are
+ * woken again after the clients already ready have had their turn.
+ */
+void accept_clients(void) {
+    for (int n = 0; n < ACCEPT_BURST; n++) {
+        struct sockaddr_in peer;
+        int clientfd = accept_connection(worker->listenfd, &peer);
+        if (clientfd == -1) {
+            switch (errno) {
+                case EAGAIN:
+                    return;
+                case EMFILE:
+                case ENFILE:
+                    shed_connection();
+                    return;
+                case EINTR:
+                case ECONNABORTED:
+                case EPROTO:
+                    // Only this connection failed; try the next one.
+                    continue;
+                default:
+                    log_error("accept", LF_ERRNO(errno));
+                    return;
+            }
+        }
+
+        // Turned away before it costs more than the accept.
+        if (ip_limit_claim(peer.sin_addr) == -1) {
+            log_warn("too_many_connections", LF_ADDR("addr", peer.sin_addr));
+            metrics_add(&worker->metrics, M_CONN_REJECTED, 1);
+            close(clientfd);
+            continue;
+        }
+        if (set_up_client_socket(clientfd) == -1
+                || event_add(worker->loop, clientfd, EV_READ | EV_EDGE) == -1) {
+            log_error("event_add", LF_INT("fd", clientfd), LF_ERRNO(errno));
+            close(clientfd);
+            ip_limit_release(peer.sin_addr);
+            continue;
+        }
+        struct client *p = add_player(&worker->new_players, clientfd,
+                                      peer.sin_addr);
+        if (p == NULL) {
+            event_del(worker->loop, clientfd);
+            close(clientfd);
+            ip_limit_release(peer.sin_addr);
+            continue;
+        }
+        // Counted only once it is a client, so every one counted is also
+        // counted closed in remove_player.
+        metrics_add(&worker->metrics, M_CONN_ACCEPTED, 1);
+        send_msg_to_client(p, WELCOME_MSG, WELCOME_MSG);
+    }
+}
+
+/* The body of each worker thread: wait for events on the worker's own
+ * listener, clients and channel, and dispatch them.
+ */
+void *worker_run(void *arg) {
     struct client *p;
-    struct sockaddr_in q;
-    fd_set rset;
 
-    if(argc != 2){
-        fprintf(stderr,"Usage: %s <dictionary filename>\n", argv[0]);
+    worker = arg;
+    log_set_worker(worker->id);
+    while (1) {
+        // Sleep until something happens or the next deadline is due. A
+        // dictionary reload never has to wait for a sleeping worker.
+        int timeout = timer_next_timeout(&worker->timers, timer_now_ms());
+        worker_unpin_dictionary();
+        worker->nready = event_wait(worker->loop, worker->ready, MAX_EVENTS, timeout);
+        worker_pin_dictionary();
+        if (worker->nready == -1) {
+            if (errno != EINTR) {
+                log_error("event_wait", LF_ERRNO(errno));
+            }
+            continue;
+        }
+        uint64_t loop_start = metrics_now();
+
+        /* Fire the deadlines that passed while we waited. This also brings
+         * the wheel up to now, which the timers set while handling the
+         * batch count from, and line_allowed reads the time off. The
+         * handles below are taken after the callbacks have run, so they
+         * are good even if a callback handled input (see throttle_expired).
+         */
+        timer_run(&worker->timers, timer_now_ms());
+
+        /* Note which client each event is for before handling any of them. A
+         * client that is closed or handed to another worker while the batch
+         * is handled leaves a stale handle behind, and its events are
+         * skipped, even if its descriptor number is reused meanwhile.
+         */
+        for (int i = 0; i < worker->nready; i++) {
+            p = client_lookup(worker->ready[i].fd);
+            worker->ready_client[i] = p != NULL ? client_handle_of(p) : 0;
+        }
+
+        /* Only the descriptors that are ready are visited. Client sockets are
+         * edge-triggered, so each one is read until it would block.
+         */
+        for (int i = 0; i < worker->nready; i++) {
+            int cur_fd = worker->ready[i].fd;
+
+            if (cur_fd == worker->channel.efd) {
+                handle_messages();
+                continue;
+            }
+
+            if (cur_fd == worker->listenfd) {
+                accept_clients();
+                continue;
+            }
+
+            if ((p = client_get(worker->ready_client[i])) == NULL) {
+                continue;
+            }
+            // The socket has room again for output we could not write.
+            if (worker->ready[i].events & EV_WRITE) {
+                mark_dirty(p);
+            }
+            if (!(worker->ready[i].events & EV_READ)) {
+                continue;
+            }
+
+            uint64_t handler_start = metrics_now();
+            handle_input(worker->ready_client[i]);
+            metrics_observe(&worker->metrics, H_HANDLER_TIME,
+                            metrics_now() - handler_start);
+        }
+
+        // Everything this batch produced goes out in one write per client.
+        fan_out_spectators();
+        flush_clients();
+        metrics_add(&worker->metrics, M_LOOP_ITERATIONS, 1);
+        metrics_observe(&worker->metrics, H_LOOP_TIME, metrics_now() - loop_start);
+    }
+    return NULL;
+}
+
+
+int main(int argc, char **argv) {
+    if(argc != 2 && argc != 3){
+        fprintf(stderr,"Usage: %s <dictionary filename> [number of workers]\n", argv[0]);
         exit(1);
     }
+    num_workers = 1;
+    if (argc == 3) {
+        num_workers = strtol(argv[2], NULL, 10);
+        if (num_workers < 1 || num_workers > MAX_WORKERS) {
+            fprintf(stderr, "The number of workers must be between 1 and %d\n",
+                    MAX_WORKERS);
+            exit(1);
+        }
+    }
+
     struct sigaction sa;
     sa.sa_handler = SIG_IGN;
     sa.sa_flags = 0;
@@ -118,291 +1239,203 @@ int main(int argc, char **argv) {
         perror("sigaction");
         exit(1);
     }
-
-    // Create and initialize the game state
-    struct game_state game;
+    // Every thread started from here on leaves the admin signals to main.
+    admin_block_signals();
+    if (log_init() == -1) {
+        exit(1);
+    }
 
     srandom((unsigned int)time(NULL));
-    // Set up the file pointer outside of init_game because we want to 
-    // just rewind the file when we need to pick a new word
-    game.dict.fp = NULL;
-    game.dict.size = get_file_length(argv[1]);
-
-    init_game(&game, argv[1]);
-    
-    // head and has_next_turn also don't change when a subsequent game is
-    // started so we initialize them here.
-    game.head = NULL;
-    game.has_next_turn = NULL;
-    
-    /* A list of client who have not yet entered their name.  This list is
-     * kept separate from the list of active players in the game, because
-     * until the new playrs have entered a name, they should not have a turn
-     * or receive broadcast messages.  In other words, they can't play until
-     * they have a name.
+    if (client_table_init() == -1) {
+        exit(1);
+    }
+    // Load the dictionary once; every new game picks from memory. SIGHUP
+    // loads the file again (see admin.c).
+    current_dict = malloc(sizeof(struct dictionary));
+    if (current_dict == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    if (load_dictionary(current_dict, argv[1]) == -1) {
+        exit(1);
+    }
+    room_directory_init();
+    name_registry_init();
+    match_init();
+    if (getenv("WORDSRV_OUTQ_LIMIT") != NULL) {
+        outq_limit = strtoul(getenv("WORDSRV_OUTQ_LIMIT"), NULL, 10);
+    }
+    if (getenv("WORDSRV_TURN_TIMEOUT") != NULL) {
+        turn_timeout = strtoul(getenv("WORDSRV_TURN_TIMEOUT"), NULL, 10) * 1000;
+    }
+    if (getenv("WORDSRV_LOGIN_TIMEOUT") != NULL) {
+        login_timeout = strtoul(getenv("WORDSRV_LOGIN_TIMEOUT"), NULL, 10) * 1000;
+    }
+    if (getenv("WORDSRV_WRITE_TIMEOUT") != NULL) {
+        write_timeout = strtoul(getenv("WORDSRV_WRITE_TIMEOUT"), NULL, 10) * 1000;
+    }
+    if (getenv("WORDSRV_SNAPSHOT_INTERVAL") != NULL) {
+        snapshot_interval = strtoul(getenv("WORDSRV_SNAPSHOT_INTERVAL"), NULL, 10) * 1000;
+        if (snapshot_interval == 0) {
+            snapshot_interval = 1;
+        }
+    }
+    if (getenv("WORDSRV_RESUME_GRACE") != NULL) {
+        resume_grace = strtoul(getenv("WORDSRV_RESUME_GRACE"), NULL, 10) * 1000;
+    }
+    if (getenv("WORDSRV_ROOM_SIZE") != NULL) {
+        room_size = strtol(getenv("WORDSRV_ROOM_SIZE"), NULL, 10);
+        if (room_size < 1) {
+            room_size = 1;
+        }
+    }
+    if (getenv("WORDSRV_MATCH_WAIT") != NULL) {
+        match_wait = strtoul(getenv("WORDSRV_MATCH_WAIT"), NULL, 10) * 1000;
+    }
+    if (getenv("WORDSRV_LINE_RATE") != NULL) {
+        line_rate = strtoul(getenv("WORDSRV_LINE_RATE"), NULL, 10);
+    }
+    if (getenv("WORDSRV_LINE_BURST") != NULL) {
+        line_burst = strtoul(getenv("WORDSRV_LINE_BURST"), NULL, 10);
+        if (line_burst < 1) {
+            line_burst = 1;
+        }
+    }
+    if (getenv("WORDSRV_MAX_PER_IP") != NULL) {
+        max_per_ip = strtol(getenv("WORDSRV_MAX_PER_IP"), NULL, 10);
+        if (max_per_ip < 0) {
+            max_per_ip = 0;
+        }
+    }
+    ip_limit_init(max_per_ip);
+
+    /* The listen backlog absorbs reconnect storms; the kernel caps it at
+     * net.core.somaxconn. WORDSRV_DEFER_ACCEPT (seconds) keeps connections
+     * from being accepted until the client sends something.
      */
-    struct client *new_players = NULL;
-    
+    int backlog = DEFAULT_BACKLOG;
+    if (getenv("WORDSRV_BACKLOG") != NULL) {
+        backlog = strtol(getenv("WORDSRV_BACKLOG"), NULL, 10);
+    }
+    int defer_accept = 0;
+    if (getenv("WORDSRV_DEFER_ACCEPT") != NULL) {
+        defer_accept = strtol(getenv("WORDSRV_DEFER_ACCEPT"), NULL, 10);
+    }
+
     struct sockaddr_in *server = init_server_addr(PORT);
-    int listenfd = set_up_server_socket(server, MAX_QUEUE);
-    
-    // initialize allset and add listenfd to the
-    // set of file descriptors passed into select
-    FD_ZERO(&allset);
-    FD_SET(listenfd, &allset);
-    // maxfd identifies how far into the set to search
-    maxfd = listenfd;
 
-    while (1) {
-        // make a copy of the set before we pass it into select
-        rset = allset;
-        nready = select(maxfd + 1, &rset, NULL, NULL, NULL);
-        if (nready == -1) {
-            perror("select");
-            continue;
+    /* Every worker gets its own listening socket on the same port, and the
+     * kernel spreads new connections across them. A worker then owns the
+     * clients it accepts and the rooms it creates, so the game code runs
+     * without locks; a player who asks for a room hosted elsewhere is
+     * handed to that worker through its channel.
+     */
+    workers = calloc(num_workers, sizeof(struct worker));
+    if (workers == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        struct worker *w = &workers[i];
+        w->id = i;
+        w->listenfd = set_up_server_socket(server, backlog, 1);
+        if (defer_accept > 0 && set_defer_accept(w->listenfd, defer_accept) == -1) {
+            exit(1);
         }
+        // Held back for when we run out of descriptors (see shed_connection).
+        w->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
 
-        if (FD_ISSET(listenfd, &rset)){
-            printf("A new client is connecting\n");
-            clientfd = accept_connection(listenfd);
+        // Rooms, each with its own game, are created as players ask for them.
+        room_table_init(&w->rooms);
 
-            FD_SET(clientfd, &allset);
-            if (clientfd > maxfd) {
-                maxfd = clientfd;
-            }
-            printf("Connection from %s\n", inet_ntoa(q.sin_addr));
-            add_player(&new_players, clientfd, q.sin_addr);
-            char *greeting = WELCOME_MSG;
-            if (write(clientfd, greeting, strlen(greeting)) == -1) {
-                fprintf(stderr, "Write to client %s failed\n", inet_ntoa(q.sin_addr));
-                remove_player(&(game.head), p->fd);
-            };
-        }
-        
-        /* Check which other socket descriptors have something ready to read.
-         * The reason we iterate over the rset descriptors at the top level and
-         * search through the two lists of clients each time is that it is
-         * possible that a client will be removed in the middle of one of the
-         * operations. This is also why we call break after handling the input.
-         * If a client has been removed the loop variables may not longer be 
-         * valid.
+        /* A list of client who have not yet entered their name.  This list is
+         * kept separate from the list of active players in the game, because
+         * until the new playrs have entered a name, they should not have a turn
+         * or receive broadcast messages.  In other words, they can't play until
+         * they have a name. Named clients stay here while they choose a room.
          */
-        int cur_fd;
-        for(cur_fd = 0; cur_fd <= maxfd; cur_fd++) {
-            if(FD_ISSET(cur_fd, &rset)) {
-                // Check if this socket descriptor is an active player
-                if (cur_fd == listenfd) {
-                    continue;
-                }
-                
-                for(p = game.head; p != NULL; p = p->next){
-                    if(cur_fd == p->fd) {
-                        //TODO - handle input from an active client
-                        //A player send messages not during his turn
-                        if (cur_fd != game.has_next_turn->fd) {
-
-                            char garbage[MAX_BUF];
-                            int res = read_partial_input_from_client(p, garbage);
-
-                            if (res == 1) {// garbage is completed
-                                send_msg_to_client(p, "It is not your turn.\r\n", &game.head);
-                                printf("Player %s tried to guess out of turn\n", p->name);
-                            } 
-
-                            else if (res == -1) {// This client is gone.
-                                char goodbye[MAX_MSG];
-                                sprintf(goodbye, "Goodbye %s\r\n", p->name);
-                                remove_player(&game.head, p->fd);
-
-                                // The last player disconnected.
-                                if (game.head == NULL) {
-                                    break;
-                                }
-
-                                // announce all clients who disconnected.
-                                broadcast(game, goodbye, NULL);
-                                // start a next turn.
-                                announce_guess_and_turn(game);
-                                break;
-                            }
-
-                        } 
-
-                        else {//Player sends messages during his turn
-                            char guess[MAX_BUF];
-                            int res = read_partial_input_from_client(p, guess);
-                            switch (res) {
-
-                                case -1:
-                                {// This client gone during his turn.
-                                    char goodbye[MAX_MSG];
-                                    sprintf(goodbye, "Goodbye %s\r\n", p->name);
-                                    advance_turn(&game);
-                                    remove_player(&game.head, p->fd);
-
-                                    if (game.head == NULL) {
-                                        break;
-                                    }
-                                    // announce all clients who disconnected.
-                                    broadcast(game, goodbye, NULL);
-                                    // start a next turn.
-                                    announce_guess_and_turn(game);
-                                    break;
-                                }
-
-                                case 0:
-                                {// Player sent empty guess letter.
-                                    send_msg_to_client(p, "Invalid guess. Your guess?\r\n", &game.head);
-                                    break;
-                                }
-
-                                case 1:
-                                {
-                                    int input_length = strlen(guess);
-                                    // Player input more than one letter.
-                                    if (input_length != 1 || guess[0] < 'a' || guess[0] > 'z') {
-                                        send_msg_to_client(p, "Invalid guess. Your guess?\r\n", &game.head);
-                                        break;
-                                    } else {// Player input a valid letter.
-                                        int letter_pos = guess[0] - 'a';
-                                        if(game.letters_guessed[letter_pos] == 1){// letter already been guessed
-                                            send_msg_to_client(p, "Already guessed. Your guess again?\r\n", &game.head);
-                                            break;
-                                        }
-                                        game.letters_guessed[letter_pos] = 1;
-
-                                        // the guessed letter not in game.word
-                                        if(check_exist(guess[0], game.word) == -1) {
-                                            char wrong_guess[MAX_MSG];
-                                            sprintf(wrong_guess, "%c is not in the word\r\n", guess[0]);
-                                            // notify server
-                                            printf("Letter %c is not in the word\n", guess[0]);
-                                            send_msg_to_client(p, wrong_guess, &game.head);
-                                            advance_turn(&game);
-                                        } else {// do nothing
-                                        }
-                                        
-                                        game.guesses_left--;
-                                        char who_guess_what[MAX_BUF];
-                                        sprintf(who_guess_what, "%s guesses: %c\r\n", p->name, guess[0]);
-                                        broadcast(game, who_guess_what, NULL);
-                                        generate_guess(&game, guess[0]);
-                                        one_turn(game);
-
-                                        // game ends when a player guesses the last hidden letter.
-                                        if(strcmp(game.word, game.guess) == 0){
-
-                                            send_msg_to_client(p, "Game over! You win!\r\n\r\n", &game.head);
-                                            char who_won[MAX_BUF];
-                                            sprintf(who_won, "Game over! %s won!\r\n\r\n", p->name);
-                                            // notify server
-                                            printf("Game over! %s won!\n", p->name);
-                                            broadcast(game, who_won, p);
-
-                                            // new game message
-                                            new_game(&game, argv);
-                                        }
-
-                                        // game ends when the players have zero guesses remaining.
-                                        else if(game.guesses_left == 0){
-
-                                            char no_left[MAX_BUF];
-                                            sprintf(no_left, "No guesses left. Game over.\r\n\r\n");
-                                            printf("No guesses left. Game over.\n");
-                                            broadcast(game, no_left, NULL);
-
-                                            // new game message
-                                            // new game message
-                                            new_game(&game, argv);
-                                        }
-
-                                        // game does not end.
-                                        else{
-                                            announce_guess_and_turn(game);
-                                        }
-
-                                    }
-                                    break;
-                                }
-                            }
-                        }
-                        break;
-                    }
-                }
-        
-                // Check if any new players are entering their names
-                for(p = new_players; p != NULL; p = p->next) {
-
-                    if(cur_fd == p->fd) {
-
-                        // TODO - handle input from an new client who has
-
-                        char name[MAX_NAME];
-                        int res = read_partial_input_from_client(p, name);
-                        switch (res) {
-
-                            case -1:
-                            {// client gone before entering name.
-                                printf("client fd=%d left game without entering a name\n", p->fd);
-                                remove_player(&new_players, p->fd);
-                                break;
-                            }
-
-                            case 0:
-                            {// client input an empty string as name.
-                                char *greeting = WELCOME_MSG;
-                                if (write(cur_fd, greeting, strlen(greeting)) == -1) {
-                                    fprintf(stderr, "Write to client %s failed\n", inet_ntoa(p->ipaddr));
-                                    remove_player(&new_players, p->fd);
-                                };
-                                break;
-                            }
-
-                            case 1:
-                            {// client input a valid string as name
-                                //input name has already exist in game
-                                if (check_dup_name(game, name)) {
-                                    p->in_ptr = p->inbuf;
-                                    char *greeting = WELCOME_MSG;
-
-                                    if (write(cur_fd, greeting, strlen(greeting)) == -1) {
-                                        fprintf(stderr, "Write to client %s failed\n", inet_ntoa(p->ipaddr));
-                                        remove_player(&new_players, p->fd);
-                                    };
-
-                                   continue;
-                                }
-
-                                strncpy(p->name, name, MAX_NAME);
-                                remove_from_newplayers(&new_players, p->fd);
-
-                                if (game.has_next_turn == NULL && game.head == NULL) {
-                                    game.has_next_turn = p;
-                                }
-                                else if (game.has_next_turn == NULL && game.head != NULL) {
-                                    fprintf(stderr, "something wrong\n");
-                                }
-
-                                p->next = game.head;
-                                game.head = p;
-
-                                // notify server
-                                printf("%s has just joined\n", p->name);
-
-                                // notify clients
-                                char new_player[MAX_MSG];
-                                sprintf(new_player, "%s has just joined\r\n", p->name);
-                                broadcast(game, new_player, NULL);
-                                one_turn(game);
-                                announce_guess_and_turn(game);
-                            }
-                        }
-                        break;
-                    } 
-                }
+        w->new_players = NULL;
+
+        /* The backend can be forced (e.g. WORDSRV_BACKEND=poll) for comparison.
+         * WORDSRV_BACKEND=uring asks for io_uring, which also writes each
+         * batch's output with one call; kernels without it get the default.
+         */
+        char *backend = getenv("WORDSRV_BACKEND");
+        w->loop = event_loop_create(backend);
+        if (w->loop == NULL && backend != NULL && strcmp(backend, "uring") == 0) {
+            log_warn("uring_unavailable", LF_ERRNO(errno));
+            w->loop = event_loop_create(NULL);
+        }
+        if (w->loop == NULL) {
+            perror("event_loop_create");
+            exit(1);
+        }
+        w->send_ring = NULL;
+        if (strcmp(w->loop->backend->name, "uring") == 0) {
+            w->send_ring = malloc(sizeof(struct uring));
+            if (w->send_ring == NULL
+                    || uring_init(w->send_ring, FLUSH_BATCH, 2 * FLUSH_BATCH) == -1) {
+                perror("uring_init");
+                exit(1);
             }
         }
+        if (channel_init(&w->channel) == -1) {
+            exit(1);
+        }
+        // Turn, login and write deadlines (see turn_timeout).
+        timer_wheel_init(&w->timers, timer_now_ms());
+        timer_init(&w->snapshot_timer, snapshot_expired);
+        timer_init(&w->match_timer, match_expired);
+        timer_init(&w->accept_timer, accept_expired);
+
+        // The listening socket stays level-triggered: we accept a burst of
+        // connections per wakeup and get woken again while more are queued.
+        if (event_add(w->loop, w->listenfd, EV_READ) == -1
+                || event_add(w->loop, w->channel.efd, EV_READ) == -1) {
+            perror("event_add");
+            exit(1);
+        }
     }
+
+    /* Carry on the games a previous run saved, before any worker runs and
+     * before the writer starts appending to the file.
+     */
+    char *snapshot_file = getenv("WORDSRV_SNAPSHOT");
+    if (snapshot_file != NULL) {
+        if (snapshot_open(snapshot_file) == -1) {
+            exit(1);
+        }
+        snapshots = 1;
+        snapshot_each(restore_room);
+        snapshot_hold_seats(timer_now_ms() + resume_grace);
+        if (snapshot_start() == -1) {
+            exit(1);
+        }
+        for (int i = 0; i < num_workers; i++) {
+            timer_add(&workers[i].timers, &workers[i].snapshot_timer, snapshot_interval);
+        }
+    }
+    timer_add(&workers[0].timers, &workers[0].match_timer, MATCH_TICK);
+    log_info("started", LF_STR("backend", workers[0].loop->backend->name),
+             LF_INT("workers", num_workers), LF_INT("port", PORT));
+
+    /* The admin port reports metrics on localhost only; it defaults to the
+     * port after the game's and WORDSRV_ADMIN_PORT=0 turns it off.
+     */
+    int admin_port = PORT + 1;
+    char *admin_env = getenv("WORDSRV_ADMIN_PORT");
+    if (admin_env != NULL) {
+        admin_port = strtol(admin_env, NULL, 10);
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        int err = pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    admin_run(admin_port, argv[1]);
     return 0;
 }
 
@@ -410,134 +1443,321 @@ int main(int argc, char **argv) {
 /* These are self writing helper functions. */
 
 /* A commonly used announce, including the guess status and announce_guess_and_turn. */
-void one_turn(struct game_state game){
-    char word_guess[MAX_MSG];
-    status_message(word_guess, &game);
-    broadcast(game, word_guess, NULL);
+void one_turn(struct room *room){
+    broadcast_msg(room, status_banner(&room->game), delta_state(&room->game), NULL);
+    state_changed(room);
+    save_later(room);
 }
 
-/* Start a new game. */
-void new_game(struct game_state *game, char **argv){
-    init_game(game, argv[1]);
-    broadcast(*game, "Let's start a new game\r\n", NULL);
-    printf("New game.\n");
-    one_turn(*game);
-    announce_guess_and_turn(*game);
+/* Start a new game in room. */
+void new_game(struct room *room){
+    init_game(&room->game, worker->dict, room->word_length);
+    broadcast(room, "Let's start a new game\r\n", "new\r\n", NULL);
+    log_info("new_game", LF_STR("room", room->name));
+    metrics_add(&worker->metrics, M_GAMES_STARTED, 1);
+    one_turn(room);
+    announce_guess_and_turn(room);
 }
 
 /* Removes client from the linked list new_players without closing its socket. */
 void remove_from_newplayers(struct client **new_players, int fd){
-    struct client **p;
-    for (p = new_players; *p && (*p)->fd != fd; p = &(*p)->next)
-        ;
-    if (*p) {
-        struct client *t = (*p)->next;
-        *p = t;
+    struct client *p = client_lookup(fd);
+    if (p && p->state != CLIENT_PLAYING) {
+        unlink_client(new_players, p);
     } else {
-        fprintf(stderr, "Trying to remove fd %d from new_players, but I don't know about it\n", fd);
+        log_warn("remove_unknown_new_player", LF_INT("fd", fd));
     } 
 }
 
-/* Check if letter is in the word word to be guessed. */
-int check_exist(char letter, char *word){
-    for(int i = 0; i < strlen(word); i++){
-        if(letter == word[i]){
-            return i;
-        }
-    }
-    return -1;
-}
-
-/* After guess letter c, update game->word. */
-void generate_guess(struct game_state *game, char c){
-    for(int i = 0; i < strlen(game->word); i++){
-        if(game->word[i] == c){
-            game->guess[i] = c;
-        }
-    }
-}
-
-/* This function is to loop to get a complete message from client. */
-int read_partial_input_from_client(struct client *p, char *result) {
+/* Get the next complete line the client sent into result, which has room
+ * for size bytes. Lines that are already buffered are returned before the
+ * socket is read again, so several lines arriving together are all seen.
+ */
+int read_partial_input_from_client(struct client *p, char *result, size_t size) {
     /*
         1. If this client is gone, return -1
         2. Empty string, return 0
         3. String completed read, return 1
-        4. Else, return 2
+        4. Nothing left to read on the socket right now, or the client
+           sent more lines than line_rate allows, return 3
     */
 
-    int clientfd = p->fd;
-    int read_num = read(clientfd, p->in_ptr, MAX_BUF);
-    
-    // This client is gone.
-    if (read_num == 0) {
-        return -1;
-    }
+    while (1) {
+        // Out of lines for now: leave the rest where it is until the
+        // throttle timer says the client may go on.
+        if (!line_allowed(p)) {
+            return 3;
+        }
+        int len = linebuf_line(&p->in, result, size);
+        if (len >= 0) {
+            if (line_rate > 0) {
+                p->tokens -= 1000;
+            }
+            return len > 0 ? 1 : 0;
+        }
 
-    // Empty string.
-    if (p->inbuf[0] == '\r' && p->inbuf[1] == '\n'){
-        p->in_ptr = p->inbuf;
-        return 0;
+        // Sockets are edge-triggered, so never block: report when we run dry.
+        int read_num = linebuf_fill(&p->in, p->fd);
+        if (read_num == -1 && errno == EINTR) {
+            continue;
+        }
+        if (read_num == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 3;
+        }
+
+        // This client is gone.
+        if (read_num <= 0) {
+            return -1;
+        }
+        metrics_add(&worker->metrics, M_BYTES_IN, read_num);
     }
+}
 
-    // String completed read.
-    else if (p->in_ptr[read_num-2] == '\r' && p->in_ptr[read_num-1] == '\n') {
-        p->in_ptr[read_num-2] = '\0';
-        strncpy(result, p->inbuf, MAX_NAME);
-        p->in_ptr = p->inbuf;
+/* Token bucket: a client earns line_rate lines a second, up to line_burst
+ * banked. With none left, the throttle timer is set for when the next is
+ * earned. Time is the worker's clock as of this batch, so this costs no
+ * system call.
+ */
+int line_allowed(struct client *p) {
+    if (line_rate == 0) {
         return 1;
-    } 
-
-    // String not completed read, keep reading.
-    else {
-        p->in_ptr += read_num;
-        return 2;
     }
-    return -2;
+    uint64_t now = worker->timers.now * TIMER_TICK_MS;
+    if (now > p->refilled) {
+        p->tokens += (now - p->refilled) * line_rate;
+        if (p->tokens >= line_burst * 1000) {
+            p->tokens = line_burst * 1000;
+            p->throttled = 0;
+        }
+        p->refilled = now;
+    }
+    if (p->tokens >= 1000) {
+        return 1;
+    }
+    // Reported once until it slows down enough to bank a full burst again.
+    if (!p->throttled) {
+        p->throttled = 1;
+        log_warn("throttled", LF_ADDR("addr", p->ipaddr), LF_INT("fd", p->fd));
+        metrics_add(&worker->metrics, M_THROTTLED, 1);
+    }
+    if (!timer_pending(&p->throttle_timer)) {
+        uint64_t wait = (1000 - p->tokens + line_rate - 1) / line_rate;
+        timer_add(&worker->timers, &p->throttle_timer, wait);
+        watch_client(p, p->want_write);
+    }
+    return 0;
 }
 
-/* Send the message in outbuf to all clients except special_player who is the current player. */
-void broadcast(struct game_state game, char *outbuf, struct client *special_player) {
-    struct client *temp = game.head;
+/* Send text to all clients in room except special_player who is the
+ * current player, and delta instead to those that speak the delta
+ * protocol. Either may be NULL to tell only the others.
+ */
+void broadcast(struct room *room, char *text, char *delta, struct client *special_player) {
+    struct msg *t = text ? msg_new(text, strlen(text)) : NULL;
+    struct msg *d = delta ? msg_new(delta, strlen(delta)) : NULL;
+    broadcast_msg(room, t, d, special_player);
+    msg_release(t);
+    msg_release(d);
+}
+
+/* Queue the shared message text, or delta for delta clients, for all
+ * clients in room except special_player. Each was formatted once; each
+ * recipient only gets a pointer to it. NULL skips those clients.
+ */
+void broadcast_msg(struct room *room, struct msg *text, struct msg *delta,
+                   struct client *special_player) {
+    struct client *temp = room->game.head;
     while (temp != NULL) {
+        struct msg *m = temp->proto == PROTO_DELTA ? delta : text;
         if (special_player != NULL && temp->fd == special_player->fd) {
             temp = temp->next;
             continue;
         } 
-        else {
-            if (dprintf(temp->fd, "%s", outbuf) < 0) {
-                fprintf(stderr, "Write to client %s failed\r\n", inet_ntoa(temp->ipaddr));
-            }
+        else if (m != NULL) {
+            queue_msg(temp, m);
         }
         temp = temp->next;
     }
 }
 
-/* Announce message msg to client, if that client is disconnected, remove him from list. */
-void send_msg_to_client(struct client *player, char *msg, struct client **list) {
+/* Queue message text, or delta if player speaks the delta protocol, for
+ * client; NULL sends nothing. It is written when the worker flushes at
+ * the end of the current batch of events.
+ */
+void send_msg_to_client(struct client *player, char *text, char *delta) {
     if (player == NULL) {
         return;
     }
-    if (dprintf(player->fd, "%s", msg) < 0) {
-        fprintf(stderr, "Write to client %s failed\n", inet_ntoa(player->ipaddr));
-        remove_player(list, player->fd);
+    char *msg = player->proto == PROTO_DELTA ? delta : text;
+    if (msg == NULL) {
+        return;
     }
+    struct msg *m = msg_new(msg, strlen(msg));
+    queue_msg(player, m);
+    msg_release(m);
 }
 
-/* Check if name already existed in game. */
-int check_dup_name(struct game_state game, char *name) {
-    struct client *tmp = game.head;
-    while (tmp != NULL) {
-        if (strcmp(tmp->name, name) == 0) {
-            return 1;
+/* Queue a reference to m on p's output queue and schedule a flush. A
+ * client whose queue grows past outq_limit is not reading what we send;
+ * it is disconnected at the end of the batch instead of holding memory
+ * (and, with blocking writes, the whole server) hostage. A NULL m means
+ * the message could not be allocated.
+ */
+void queue_msg(struct client *p, struct msg *m) {
+    if (p->closing) {
+        return;
+    }
+    if (m == NULL || outq_push(&p->out, m) == -1 || p->out.bytes > outq_limit) {
+        log_warn("slow_client", LF_ADDR("addr", p->ipaddr), LF_INT("fd", p->fd),
+                 LF_INT("queued", p->out.bytes));
+        metrics_add(&worker->metrics, M_SLOW_CLIENTS, 1);
+        p->closing = 1;
+    }
+    mark_dirty(p);
+}
+
+void mark_dirty(struct client *p) {
+    if (p->dirty) {
+        return;
+    }
+    p->dirty = 1;
+    p->dirty_prev = NULL;
+    p->dirty_next = worker->dirty;
+    if (worker->dirty != NULL) {
+        worker->dirty->dirty_prev = p;
+    }
+    worker->dirty = p;
+}
+
+void unmark_dirty(struct client *p) {
+    if (!p->dirty) {
+        return;
+    }
+    if (p->dirty_prev != NULL) {
+        p->dirty_prev->dirty_next = p->dirty_next;
+    } else {
+        worker->dirty = p->dirty_next;
+    }
+    if (p->dirty_next != NULL) {
+        p->dirty_next->dirty_prev = p->dirty_prev;
+    }
+    p->dirty = 0;
+}
+
+/* Write out the output queued for every client during this batch, up to
+ * FLUSH_BATCH clients at a time. Sockets that can't take everything are
+ * watched for writability and flushed again when they drain. Clients whose
+ * writes fail or who fell too far behind are disconnected here, where no
+ * handler is using them; that may queue goodbyes for others, which are
+ * flushed in the same pass.
+ */
+void flush_clients(void) {
+    struct client *batch[FLUSH_BATCH];
+    size_t queued[FLUSH_BATCH];
+    struct outq_job *jobs = worker->jobs;
+
+    while (worker->dirty != NULL) {
+        int n = 0;
+        while (worker->dirty != NULL && n < FLUSH_BATCH) {
+            struct client *p = worker->dirty;
+            unmark_dirty(p);
+            batch[n] = p;
+            queued[n] = p->out.bytes;
+            jobs[n].q = p->closing ? NULL : &p->out;
+            jobs[n].fd = p->fd;
+            n++;
+        }
+
+        // With io_uring every socket of the batch is written by one call.
+        if (worker->send_ring != NULL) {
+            outq_flush_batch(worker->send_ring, jobs, n);
+        } else {
+            for (int i = 0; i < n; i++) {
+                if (jobs[i].q != NULL) {
+                    jobs[i].res = outq_flush(jobs[i].q, jobs[i].fd);
+                    jobs[i].err = errno;
+                }
+            }
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct client *p = batch[i];
+            if (jobs[i].q != NULL) {
+                flushed(p, jobs[i].res, jobs[i].err, queued[i]);
+            }
+            if (p->closing) {
+                drop_client(p);
+            }
         }
-        tmp = tmp->next;
     }
+}
+
+/* Act on how writing p's output went: res is as outq_flush returns it,
+ * err the errno of a failure, and queued what was waiting beforehand.
+ */
+void flushed(struct client *p, int res, int err, size_t queued) {
+    if (res == -1) {
+        log_warn("write_failed", LF_ADDR("addr", p->ipaddr),
+                 LF_INT("fd", p->fd), LF_ERRNO(err));
+        metrics_add(&worker->metrics, M_WRITE_FAILURES, 1);
+        p->closing = 1;
+    } else if (res != p->want_write) {
+        // Only watch for writability while output is left over.
+        watch_client(p, res);
+    }
+    /* A socket that takes nothing for write_timeout is dropped. The
+     * clock restarts whenever some of the output goes out.
+     */
+    if (res == 1 && write_timeout > 0) {
+        if (p->out.bytes != queued || !timer_pending(&p->write_timer)) {
+            timer_add(&worker->timers, &p->write_timer, write_timeout);
+        }
+    } else {
+        timer_cancel(&p->write_timer);
+    }
+    // A failed flush may still have written part of the queue.
+    metrics_add(&worker->metrics, M_BYTES_OUT, queued - p->out.bytes);
+
+    // A spectator that has caught up gets the state it missed meanwhile,
+    // which goes out in the same pass of flush_clients.
+    if (res == 0 && p->behind && !p->closing) {
+        p->behind = 0;
+        send_state(p);
+    }
+}
+
+/* A throttled client's input is left unread, and the poll backend is
+ * level-triggered: it would report the socket on every wait until the
+ * client may read on. So nobody watches for input while the throttle
+ * timer runs.
+ */
+int watch_client(struct client *p, int want_write) {
+    int events = EV_EDGE | (want_write ? EV_WRITE : 0);
+    if (!timer_pending(&p->throttle_timer)) {
+        events |= EV_READ;
+    }
+    if (event_mod(worker->loop, p->fd, events) == -1) {
+        log_error("event_mod", LF_INT("fd", p->fd), LF_ERRNO(errno));
+        return -1;
+    }
+    p->want_write = want_write;
     return 0;
 }
 
-/* Move the has_next_turn pointer to the next active client */
-void advance_turn(struct game_state *game) {
+/* Disconnect p, taking it out of its room if it has joined one. */
+void drop_client(struct client *p) {
+    if (p->state == CLIENT_PLAYING) {
+        leave_room(p);
+    } else if (p->state == CLIENT_WATCHING) {
+        stop_watching(p);
+    } else {
+        remove_player(&worker->new_players, p->fd);
+    }
+}
+
+/* Move the room's has_next_turn pointer to the next active client */
+void advance_turn(struct room *room) {
+    struct game_state *game = &room->game;
     struct client *next = game->has_next_turn->next;
     if (next == NULL) {
         game->has_next_turn = game->head;
@@ -546,12 +1766,90 @@ void advance_turn(struct game_state *game) {
     }
 }
 
-/* Announce the current player to guess and tell others whose turn it is. */
-void announce_guess_and_turn(struct game_state game){
-    send_msg_to_client(game.has_next_turn, "Your guess?\r\n", &game.head);
+/* Announce the current player in room to guess and tell others whose turn it is. */
+void announce_guess_and_turn(struct room *room){
+    struct client *player = room->game.has_next_turn;
+    // Delta clients see their own name in turn= and need no prompt.
     char turn_msg[MAX_MSG];
-    sprintf(turn_msg, "It's %s's turn.\r\n", game.has_next_turn->name);
-    broadcast(game, turn_msg, game.has_next_turn);
+    room->turns++;
+    sprintf(turn_msg, "turn=%s\r\n", player->name);
+    send_msg_to_client(player, "Your guess?\r\n", turn_msg);
+    broadcast(room, NULL, turn_msg, player);
+    sprintf(turn_msg, "It's %s's turn.\r\n", player->name);
+    broadcast(room, turn_msg, NULL, player);
     // notify server
-    printf("It's %s's turn.\n", game.has_next_turn->name);
+    log_debug("turn", LF_STR("room", room->name), LF_STR("player", player->name));
+
+    // A new turn gets a new deadline; announcing the same turn again (as
+    // when someone joins) does not extend it.
+    if (turn_timeout > 0 && (room->timed_player != player
+                             || !timer_pending(&room->turn_timer))) {
+        room->timed_player = player;
+        timer_add(&worker->timers, &room->turn_timer, turn_timeout);
+    }
+}
+
+/* Nobody guessed in time: tell the room and pass the turn on. A player
+ * alone in a room holds nobody up and keeps the turn; the clock starts
+ * again when someone joins. A held room's timer runs until it stops
+ * being held, and closes it if nobody has come.
+ */
+void turn_expired(struct timer *t) {
+    struct room *room = timer_owner(t, struct room, turn_timer);
+    struct client *player = room->game.has_next_turn;
+    // A held room nobody came to (see restore_room).
+    if (room->num_players == 0 && room->spectators == NULL) {
+        close_room(room);
+        return;
+    }
+    // The grace window ran out with players in the room: with no turn
+    // deadlines, nobody's turn is up.
+    if (room->num_players < 2 || turn_timeout == 0) {
+        return;
+    }
+    log_info("turn_timeout", LF_STR("room", room->name),
+             LF_STR("player", player->name));
+    metrics_add(&worker->metrics, M_TIMEOUTS, 1);
+
+    char too_slow[MAX_MSG];
+    sprintf(too_slow, "timeout=%s\r\n", player->name);
+    send_msg_to_client(player, "Time is up.\r\n", too_slow);
+    broadcast(room, NULL, too_slow, player);
+    sprintf(too_slow, "%s ran out of time.\r\n", player->name);
+    broadcast(room, too_slow, NULL, player);
+    advance_turn(room);
+    save_later(room);
+    announce_guess_and_turn(room);
+}
+
+/* A new client took too long to choose a name and a room. It is
+ * disconnected once the current batch is handled.
+ */
+void idle_expired(struct timer *t) {
+    struct client *p = timer_owner(t, struct client, idle_timer);
+    log_info("login_timeout", LF_ADDR("addr", p->ipaddr), LF_INT("fd", p->fd));
+    metrics_add(&worker->metrics, M_TIMEOUTS, 1);
+    p->closing = 1;
+    mark_dirty(p);
+}
+
+/* A throttled client has earned a line: watch its socket for input again
+ * and handle what it sent meanwhile, which raises no new edge.
+ */
+void throttle_expired(struct timer *t) {
+    struct client *p = timer_owner(t, struct client, throttle_timer);
+    watch_client(p, p->want_write);
+    handle_input(client_handle_of(p));
+}
+
+/* A client's socket took none of its output for write_timeout: the client
+ * has stopped reading, or its connection is dead without us being told.
+ */
+void write_expired(struct timer *t) {
+    struct client *p = timer_owner(t, struct client, write_timer);
+    log_warn("write_stalled", LF_ADDR("addr", p->ipaddr), LF_INT("fd", p->fd),
+             LF_INT("queued", p->out.bytes));
+    metrics_add(&worker->metrics, M_TIMEOUTS, 1);
+    p->closing = 1;
+    mark_dirty(p);
 }
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "worker.h"
+
+struct worker *workers;
+int num_workers;
+__thread struct worker *worker;
+struct dictionary *current_dict;
+
+int channel_init(struct channel *ch) {
+    if (pthread_mutex_init(&ch->lock, NULL) != 0) {
+        return -1;
+    }
+    ch->head = NULL;
+    ch->tail = NULL;
+    ch->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ch->efd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+int channel_send(struct worker *to, struct message *msg) {
+    struct channel *ch = &to->channel;
+    msg->next = NULL;
+
+    pthread_mutex_lock(&ch->lock);
+    int was_empty = (ch->head == NULL);
+    if (ch->tail != NULL) {
+        ch->tail->next = msg;
+    } else {
+        ch->head = msg;
+    }
+    ch->tail = msg;
+    pthread_mutex_unlock(&ch->lock);
+
+    // Only the first message needs to wake the receiver up.
+    if (was_empty) {
+        uint64_t one = 1;
+        // The caller logs the failure, knowing which worker it was for.
+        if (write(ch->efd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct message *channel_take(struct channel *ch) {
+    uint64_t count;
+    // Clear the wakeup before taking the queue so a message sent after we
+    // take it wakes us again.
+    while (read(ch->efd, &count, sizeof(count)) > 0)
+        ;
+
+    pthread_mutex_lock(&ch->lock);
+    struct message *msgs = ch->head;
+    ch->head = NULL;
+    ch->tail = NULL;
+    pthread_mutex_unlock(&ch->lock);
+    return msgs;
+}
+
+/* worker->dict works as a hazard pointer: a worker announces the dictionary
+ * it is about to use, then checks that it is still current, so that once
+ * publish_dictionary has swapped current_dict it only has to wait for the
+ * workers that announced the old one. A worker holds its dictionary for
+ * one batch at most, and none while it sleeps, so nobody waits long and
+ * games are never paused.
+ */
+void worker_pin_dictionary(void) {
+    struct dictionary *d;
+    do {
+        d = __atomic_load_n(&current_dict, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&worker->dict, d, __ATOMIC_SEQ_CST);
+    } while (d != __atomic_load_n(&current_dict, __ATOMIC_SEQ_CST));
+}
+
+void worker_unpin_dictionary(void) {
+    __atomic_store_n(&worker->dict, NULL, __ATOMIC_RELEASE);
+}
+
+struct dictionary *publish_dictionary(struct dictionary *dict) {
+    struct dictionary *old = __atomic_exchange_n(&current_dict, dict,
+                                                 __ATOMIC_SEQ_CST);
+    for (int i = 0; i < num_workers; i++) {
+        while (__atomic_load_n(&workers[i].dict, __ATOMIC_SEQ_CST) == old) {
+            struct timespec nap = { 0, 1000000 };
+            nanosleep(&nap, NULL);
+        }
+    }
+    return old;
+}
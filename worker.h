@@ -0,0 +1,106 @@
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <pthread.h>
+
+#include "gameplay.h"
+#include "client.h"
+#include "event.h"
+#include "room.h"
+#include "metrics.h"
+#include "timer.h"
+
+#define MAX_WORKERS 64
+#define FLUSH_BATCH 128           // clients written out together (see flush_clients)
+
+/* The kinds of work one worker can hand to another. */
+enum message_type {
+    MSG_JOIN_ROOM,      // client wants to join room, which the receiver hosts
+    MSG_MATCHED,        // the receiver's waiting client was matched into room
+    MSG_CREATE_ROOM     // create room, whose matched players are on their way
+};
+
+struct message {
+    enum message_type type;
+    struct client *client;
+    client_handle handle;         // MSG_MATCHED: the client, if still there
+    char room[MAX_NAME];
+    int watch;                    // to watch the room rather than play
+    int word_length;              // MSG_CREATE_ROOM: of the room's words
+    struct message *next;
+};
+
+/* The only way workers talk to each other: a locked queue of messages and
+ * an eventfd that wakes the receiving worker's event loop.
+ */
+struct channel {
+    pthread_mutex_t lock;
+    struct message *head;
+    struct message *tail;
+    int efd;
+};
+
+/* Each worker thread owns a listening socket, an event loop, and every
+ * client and room it hosts. Nothing in a worker is touched by another
+ * thread except through its channel.
+ */
+struct worker {
+    int id;
+    pthread_t thread;
+    int listenfd;
+    int spare_fd;                 // a descriptor to give up when out of them
+    struct event_loop *loop;
+    struct room_table rooms;
+    struct client *new_players;   // clients still entering a name or room
+    struct client *dirty;         // clients with output to flush
+    struct room *changed;         // rooms with a state for their spectators
+    struct room *unsaved;         // rooms changed since the last snapshot
+    struct timer snapshot_timer;  // saves them every snapshot_interval
+    struct timer match_timer;     // matches players who waited long enough
+    struct timer accept_timer;    // watches the listener again once it had
+                                  // to stop for want of descriptors
+    int players;                  // in its rooms; read by other workers to
+                                  // place matched rooms
+    struct channel channel;
+
+    struct event ready[MAX_EVENTS];   // the batch being dispatched
+    client_handle ready_client[MAX_EVENTS];   // the client behind each one
+    int nready;
+    struct timer_wheel timers;    // deadlines of this worker's clients and rooms
+    struct uring *send_ring;      // batches the writes, with the uring backend
+    struct outq_job jobs[FLUSH_BATCH];
+
+    struct metrics metrics;       // written only by this worker
+
+    // current_dict as it was when this batch started, or NULL while the
+    // worker waits for events (see worker_pin_dictionary).
+    struct dictionary *dict;
+};
+
+extern struct worker *workers;
+extern int num_workers;
+
+/* The worker running on the calling thread. */
+extern __thread struct worker *worker;
+
+/* The dictionary new games pick their words from. A reload replaces it as
+ * a whole; workers never read it directly, only through worker->dict.
+ */
+extern struct dictionary *current_dict;
+
+int channel_init(struct channel *ch);
+/* Queue msg for the worker to and wake it up. Returns -1 on failure. */
+int channel_send(struct worker *to, struct message *msg);
+/* Take every queued message (in order) and clear the wakeup. */
+struct message *channel_take(struct channel *ch);
+
+/* Set worker->dict to current_dict for the batch about to be handled. */
+void worker_pin_dictionary(void);
+/* Let go of worker->dict before waiting for events. */
+void worker_unpin_dictionary(void);
+/* Make dict current and wait until no worker uses the old dictionary any
+ * more. Returns the old one, for the caller to free.
+ */
+struct dictionary *publish_dictionary(struct dictionary *dict);
+
+#endif